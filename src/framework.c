@@ -1,7 +1,22 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <memory.h>
 #include <string.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
 
 int token;            // current token
 char *src, *old_src;  // pointer to source code string
@@ -31,10 +46,12 @@ simplicity, we care about `text segment`, `data segment` and `stack`,
 we don't need `bss segment` because our compiler don't support uninitialized vars, 
 beside, we use instruct `MSET` to malloc memory(dynamic)
 *******************************************************************/
-int *text,            // text segment
-    *old_text,        // for dump text segment
-    *stack;           // stack
-char *data;           // data segment, only for string
+__thread int *text,   // text segment, private to each code generating thread
+    *old_text;        // for dump text segment
+int *stack;           // stack
+char *data,           // data segment, only for string
+     *old_data;       // base of data segment
+__thread int *lines;  // source line of the statement starting at each word of text
 
 /******************************************************************
 register for store program running status, we use four registers as follows:
@@ -49,9 +66,80 @@ int *pc, *bp, *sp, ax, cycle;     // virtual machine registers
 /******************************************************************
 instructions for CPU
 *******************************************************************/
-enum {LEA,IMM,JMP,CALL,JZ,JNZ,ENT,ADJ,LEV,LI,LC,SI,SC,PUSH,
+enum {LEA,IMM,JMP,CALL,JZ,JNZ,ENT,ADDI,IMMF,NATV,LAZY,ADJ,LEV,LI,LC,SI,SC,PUSH,
       OR,XOR,AND,EQ,NE,LT,GT,LE,GE,SHL,SHR,ADD,SUB,
-      MUL,DIV,MOD,OPEN,READ,CLOS,PRTF,MALC,MSET,MCMP,EXIT};
+      MUL,DIV,MOD,FADD,FSUB,FMUL,FDIV,FEQ,FNE,FLT,FGT,FLE,FGE,ITOF,FTOI,OPEN,READ,CLOS,PRTF,MALC,MSET,MCMP,SPWN,YILD,ARED,APOL,AWAT,SNAP,EXIT,FEND};
+
+// names of instructions, 5 characters each
+char *op_names = "LEA ,IMM ,JMP ,CALL,JZ  ,JNZ ,ENT ,ADDI,IMMF,NATV,LAZY,ADJ ,LEV ,LI  ,LC  ,SI  ,SC  ,PUSH,"
+                 "OR  ,XOR ,AND ,EQ  ,NE  ,LT  ,GT  ,LE  ,GE  ,SHL ,SHR ,ADD ,SUB ,"
+                 "MUL ,DIV ,MOD ,FADD,FSUB,FMUL,FDIV,FEQ ,FNE ,FLT ,FGT ,FLE ,FGE ,ITOF,FTOI,OPEN,READ,CLOS,PRTF,MALC,MSET,MCMP,SPWN,YILD,ARED,APOL,AWAT,SNAP,EXIT,FEND,";
+
+/**
+  * the word holding double `d`, only whole when int is as wide as double,
+  * which type_specifier() and next_token() check before any double.
+  */
+int double_bits(double d) {
+  int v;
+
+  v = 0;
+  memcpy(&v, &d, (sizeof(int) < sizeof(double)) ? sizeof(int) : sizeof(double));
+  return v;
+}
+
+/**
+  * the double held in word `v`.
+  */
+double bits_double(int v) {
+  double d;
+
+  d = 0;
+  memcpy(&d, &v, (sizeof(int) < sizeof(double)) ? sizeof(int) : sizeof(double));
+  return d;
+}
+
+/**
+  * printf for the VM, `args` walks down the stack from the first argument
+  * after `fmt`. Every conversion is printed on its own so that %f, %e and
+  * %g get their word as a double.
+  */
+int print_format(char *fmt, int *args) {
+  char *part, *p, *q;
+  int n;
+
+  part = malloc(strlen(fmt) + 1);
+  n = 0;
+  p = fmt;
+  while (*p) {
+    // copy up to and including the next conversion
+    q = p;
+    while (*q && (*q != '%' || q[1] == '%')) {
+      q = q + ((*q == '%') ? 2 : 1);
+    }
+    if (*q) {
+      q++;
+      while (*q && !strchr("diouxXcspfFeEgGaAn", *q)) {
+        q++;
+      }
+      if (*q) {
+        q++;
+      }
+    }
+    memcpy(part, p, q - p);
+    part[q - p] = 0;
+
+    if (*q == 0 && !strchr(part, '%')) {
+      n = n + printf("%s", part);
+    } else if (strchr("fFeEgGaA", q[-1])) {
+      n = n + printf(part, bits_double(*args--));
+    } else {
+      n = n + printf(part, *args--);
+    }
+    p = q;
+  }
+  free(part);
+  return n;
+}
 
 /******************************************************************
                    +-------+                      +--------+
@@ -60,9 +148,10 @@ enum {LEA,IMM,JMP,CALL,JZ,JNZ,ENT,ADJ,LEV,LI,LC,SI,SC,PUSH,
 *******************************************************************/
 // tokens and classes
 enum  {
-  Num = 128, Fun, Sys, Glo, Loc, Id,
-  Char, Else, Enum, If, Int, Return, Sizeof, While,
-  Assign, Cond, Lor, Lan, Or, Xor, And, Eq, Ne, Lt, Gt, Le, Ge, Shl, Shr, Add, Sub, Mul, Div, Mod, Inc, Dec, Brak};
+  Num = 128, Fun, Sys, Ext, Glo, Loc, Id, Fnum,
+  Char, Else, Enum, If, Int, Return, Sizeof, While, Struct, Double,
+  Assign, OrAssign, XorAssign, AndAssign, ShlAssign, ShrAssign, AddAssign, SubAssign, MulAssign, DivAssign, ModAssign,
+  Cond, Lor, Lan, Or, Xor, And, Eq, Ne, Lt, Gt, Le, Ge, Shl, Shr, Add, Sub, Mul, Div, Mod, Inc, Dec, Brak, Dot, Arrow};
 
 /******************************************************************
 define identifier {
@@ -75,233 +164,644 @@ define identifier {
   int bclass;       // global identifier when local var and global var are the same
   int btype;
   int bvalue;
+  int size;         // function: words of code from ENT to the last LEV
+                    // array: size in bytes, 0 for scalar variables
+  int params;       // function only, number of parameters
+  int doubles;      // function only, bit i set if parameter i is double
+  int bsize;
+  int depth;        // function only, most words of its frame, see verify()
 }
 
 Symbol table:
-----+-----+----+----+----+-----+-----+-----+------+------+----
- .. |token|hash|name|type|class|value|btype|bclass|bvalue| ..
-----+-----+----+----+----+-----+-----+-----+------+------+----
-    |<---       one single identifier                --->|
+----+-----+----+----+----+-----+-----+-----+------+------+----+------+-------+-----+-----+----
+ .. |token|hash|name|type|class|value|btype|bclass|bvalue|size|params|doubles|bsize|depth| ..
+----+-----+----+----+----+-----+-----+-----+------+------+----+------+-------+-----+-----+----
+    |<---                          one single identifier                           --->|
 *******************************************************************/
 int token_val;                // value of current token
 int *current_id;              // current parsed id
 int *symbols;                 // symbol table
+int *symbol_end;              // first free entry of the symbol table
+int *id_index;                // open hash of the symbol table by name
+int id_mask;                  // number of slots of `id_index` - 1
 
 // fields of identifier
-enum {Token, Hash, Name, Type, Class, Value, BType, BClass, BValue, IdSize};
+enum {Token, Hash, Name, Type, Class, Value, BType, BClass, BValue, Size, Params, Doubles, BSize, Depth, IdSize};
 
-// types of variable/funtion
-enum {CHAR, INT, PTR};
+// types of variable/funtion, struct number k is STRUCT + k, a double
+// is kept in a word like int and needs int as wide as double
+enum {CHAR, INT, DOUBLE, STRUCT, PTR = 256};
 int *idmain;                  // the main function
 
+/******************************************************************
+struct types: one record in `structs` per tag and one in `members` per
+member. members keep the declaration order, each at its natural
+alignment so that chars share a word, and the size is rounded up to
+the largest alignment so that arrays of structs stay contiguous.
+*******************************************************************/
+int *structs;                 // struct records, indexed by type - STRUCT
+int struct_count;
+int *members;                 // member records of all structs
+int member_count;
+
+// fields of struct, size is 0 until the members are declared
+enum {StructTag, StructBytes, StructAlign, StructSize};
+
+// fields of member, bytes is the size of an array member, 0 otherwise
+enum {MemberStruct, MemberId, MemberType, MemberOffset, MemberBytes, MemberSize};
 
 /**
-  * get next token, the function will ignore black character.
+  * whether `type` is a struct, not a pointer to one.
   */
-void next() {
-  char *last_pos;
-  int hash;
+int is_struct(int type) {
+  return type >= STRUCT && type < PTR;
+}
+
+/**
+  * size of a value of `type` in bytes.
+  */
+int type_size(int type) {
+  if (type == CHAR) {
+    return sizeof(char);
+  }
+  if (is_struct(type)) {
+    return structs[(type - STRUCT) * StructSize + StructBytes];
+  }
+  return sizeof(int);
+}
+
+/**
+  * alignment of a value of `type` in bytes.
+  */
+int type_align(int type) {
+  if (is_struct(type)) {
+    return structs[(type - STRUCT) * StructSize + StructAlign];
+  }
+  return type_size(type);
+}
+
+
+/******************************************************************
+two-phase lexing: with `-lex n` program() first scans the whole source
+into `tokens`, three words per token: kind, value and line. the value
+of an identifier is its index in the symbol table, that of a string
+its offset in the source. the source is cut at line breaks into n
+chunks scanned on n threads, identifiers are looked up afterwards in
+source order so the symbol table comes out as with next() alone.
+next() is then a cursor over the array and only copies strings into
+`data` when the parser gets to them.
+*******************************************************************/
+int *tokens;                  // lexed tokens
+int *token_pos, *token_end;   // cursor of next() in `tokens`, 0 to lex on the fly
+int lex_threads;              // threads of the pre-pass, 0 to lex on the fly
+int lex_count;                // number of lexed tokens
+int lex_time;                 // microseconds spent in the pre-pass
+
+// fields of token
+enum {LexKind, LexValue, LexLine, LexSize};
+
+// fields of chunk of source
+enum {ChunkStart, ChunkEnd, ChunkTokens, ChunkCount, ChunkLines, ChunkSize};
+
+/******************************************************************
+statistics: with `-stats` main() times its phases and prints them at
+exit with the counts of the compiler, one `stats <name> <value>` line
+each so that scripts can pick them up. lexing is the time spent in
+next() and the pre-pass of `-lex`, codegen is the rest of program().
+functions compiled by `-lazy` are counted in eval.
+*******************************************************************/
+int stats;                    // print the statistics at exit
+int64_t stats_phases[5];      // nanoseconds of every phase, 64 bits as int may wrap in seconds
+int stats_tokens;             // tokens returned by next()
+int stats_lookups;            // identifiers looked up in `symbols`
+int stats_inserts;            // identifiers added to `symbols`
+int64_t stats_overhead;       // nanoseconds of one stats_clock(), taken off the lexing time
+
+// phases of main()
+enum {StatRead, StatBootstrap, StatLex, StatCodegen, StatEval};
+
+/**
+  * nanoseconds of the monotonic clock.
+  */
+int64_t stats_clock() {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/**
+  * measure the cost of stats_clock(), the least of a few tries.
+  */
+void stats_calibrate() {
+  int64_t t;
+  int i;
+
+  stats_overhead = 1000000;
+  i = 0;
+  while (i++ < 100) {
+    t = stats_clock();
+    t = stats_clock() - t;
+    if (t < stats_overhead) {
+      stats_overhead = t;
+    }
+  }
+}
+
+/**
+  * print the time of every phase and the counts.
+  */
+void stats_dump() {
+  printf("\nstats read_us %d\n", (int)(stats_phases[StatRead] / 1000));
+  printf("stats bootstrap_us %d\n", (int)(stats_phases[StatBootstrap] / 1000));
+  printf("stats lex_us %d\n", (int)(stats_phases[StatLex] / 1000));
+  printf("stats codegen_us %d\n", (int)(stats_phases[StatCodegen] / 1000));
+  printf("stats eval_us %d\n", (int)(stats_phases[StatEval] / 1000));
+  printf("stats tokens %d\n", stats_tokens);
+  printf("stats lookups %d\n", stats_lookups);
+  printf("stats inserts %d\n", stats_inserts);
+  printf("stats words %d\n", text - old_text);
+}
+
+/**
+  * scan the token at `*s` and move `*s` past it, this is the part of
+  * the lexer that touches no global state. `*newlines` counts the line
+  * breaks passed and `*start` is set to where the token begins. `*value`
+  * is set for a number, an identifier is returned as Id with `*value`
+  * its hash and a string as '"', left for the caller to look up or copy.
+  */
+int scan(char **s, int *value, char **start, int *newlines) {
+  char *p, *q;
+  int tk, v;
 
+  p = *s;
   // ignore unknown token
-  while (token = *src) {
-    ++src;
+  while ((tk = *p)) {
+    *start = p++;
 
     // parse token
-    if (token == '\n') {
-      ++line;
-    } else if (token == '#') {
+    if (tk == '\n') {
+      ++*newlines;
+    } else if (tk == '#') {
       // skip macro
-      while (*src != 0 && *src != '\n') {
-        src++;
+      while (*p != 0 && *p != '\n') {
+        p++;
       }
-    } else if ((token >= 'a' && token <= 'z') || (token >= 'A' && token <= 'Z') || (token == '_')) {
+    } else if ((tk >= 'a' && tk <= 'z') || (tk >= 'A' && tk <= 'Z') || (tk == '_')) {
       // parse identifier
-      last_pos = src - 1;
-      hash = token;
-      
-      while ((*src >= 'a' && *src <= 'z') || (*src >= 'A' && *src <= 'Z') || (*src >= '0' && *src <= '9') || (*src == '_')) {
-        hash = hash * 147 + *src;
-        src++;
-      }
-
-      // look for existing identifier, linear search
-      current_id = symbols;
-      while (current_id[Token]) {
-        // find and return
-        if (current_id[Hash] == hash && !memcmp((char*)current_id[Name], last_pos, src - last_pos)) {
-          token = current_id[Token];
-          return;
-        }
-        current_id = current_id + IdSize;
+      v = tk;
+      while ((*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z') || (*p >= '0' && *p <= '9') || (*p == '_')) {
+        v = v * 147 + *p;
+        p++;
       }
-
-      // not find and store new id
-      current_id[Name] = (int)last_pos;
-      current_id[Hash] = hash;
-      token = current_id[Token] = Id;
-      return;
-    } else if (token >= '0' && token <= '9') {
-      // parse number, support dec(123) hex(0x123) oct(0123)
-      token_val = token - '0';
-      if (token_val > 0) {
+      tk = Id;
+      break;
+    } else if (tk >= '0' && tk <= '9') {
+      // parse number, support dec(123) hex(0x123) oct(0123) and
+      // floating point (1.5 2e3), whose value is the word holding it
+      v = tk - '0';
+      q = p;
+      while (*q >= '0' && *q <= '9') {
+        q++;
+      }
+      if (*q == '.' || *q == 'e' || *q == 'E') {
+        v = double_bits(strtod(*start, &p));
+        tk = Fnum;
+        break;
+      }
+      if (v > 0) {
         // dec, starts with [1-9]
-        while (*src >= '0' && *src <= '9') {
-          token_val = token_val * 10 + *src++ - '0';
+        while (*p >= '0' && *p <= '9') {
+          v = v * 10 + *p++ - '0';
         }
       } else {
         // start with number 0
-        if (*src == 'x' || *src == 'X') {
+        if (*p == 'x' || *p == 'X') {
           // hex, starts with x or X
-          token = *++src;
-          while ((token >= '0' && token <= '9') || (token >= 'a' && token <= 'f') || (token >= 'A' && token <= 'F')) {
-            token_val = token_val * 16 + (token & 15) + (token >= 'A' ? 9 : 0);
-            token = *++src;
+          tk = *++p;
+          while ((tk >= '0' && tk <= '9') || (tk >= 'a' && tk <= 'f') || (tk >= 'A' && tk <= 'F')) {
+            v = v * 16 + (tk & 15) + (tk >= 'A' ? 9 : 0);
+            tk = *++p;
           }
         } else {
           // oct
-          while (*src >= '0' && *src <= '7') {
-            token_val = token_val * 8 + *src++ - '0';
+          while (*p >= '0' && *p <= '7') {
+            v = v * 8 + *p++ - '0';
           }
         }
       }
 
-      token = Num;
-      return;
-    } else if (token == '"' || token == '\'') {
-      // parse string literal, currently only '\n' supporte escape
-      // store the string literal into data
-      last_pos = data;
-      while (*src != 0 && *src != token) {
-        token_val = *src++;
-        if (token_val == '\\') {
+      tk = Num;
+      break;
+    } else if (tk == '"' || tk == '\'') {
+      // skip string literal, currently only '\n' supporte escape, the
+      // value of a character literal is its last character
+      v = 0;
+      while (*p != 0 && *p != tk) {
+        v = *p++;
+        if (v == '\\') {
           // escape charater
-          token_val = *src++;
-          if (token_val == 'n') {
-            token_val = '\n';
+          v = *p++;
+          if (v == 'n') {
+            v = '\n';
           }
         }
-
-        if (token == '"') {
-          *data++ = token_val;
-        }
       }
 
-      src++;
-      // if it is a single character, return Num token
-      if (token == '"') {
-        token_val = (int)last_pos;
-      } else {
-        token = Num;
+      p++;
+      if (tk == '\'') {
+        tk = Num;
       }
-      return;
-    } else if (token == '/') {
-      if (*src == '/') {
+      break;
+    } else if (tk == '/') {
+      if (*p == '/') {
         // skip comments, only // type
-        while (*src != 0 && *src != '\n') {
-          ++src;
+        while (*p != 0 && *p != '\n') {
+          ++p;
         }
       } else {
         // divide operator
-        token = Div;
-        return;
+        tk = Div;
+        if (*p == '=') {
+          p++;
+          tk = DivAssign;
+        }
+        break;
       }
-    } else if (token == '=') {
+    } else if (tk == '=') {
       // parse '==' and '='
-      if (*src == '=') {
-        src++;
-        token = Eq;
+      if (*p == '=') {
+        p++;
+        tk = Eq;
       } else {
-        token = Assign;
+        tk = Assign;
       }
-      return;
-    } else if (token == '+') {
-      // parse '+' and '++'
-      if (*src == '+') {
-        src++;
-        token = Inc;
+      break;
+    } else if (tk == '+') {
+      // parse '+', '++' and '+='
+      if (*p == '+') {
+        p++;
+        tk = Inc;
+      } else if (*p == '=') {
+        p++;
+        tk = AddAssign;
       } else {
-        token = Add;
+        tk = Add;
       }
-      return;
-    } else if (token == '-') {
-      // parse '-' and '--'
-      if (*src == '-') {
-        src ++;
-        token = Dec;
+      break;
+    } else if (tk == '-') {
+      // parse '-', '--', '-=' and '->'
+      if (*p == '-') {
+        p ++;
+        tk = Dec;
+      } else if (*p == '=') {
+        p ++;
+        tk = SubAssign;
+      } else if (*p == '>') {
+        p ++;
+        tk = Arrow;
       } else {
-        token = Sub;
+        tk = Sub;
       }
-      return;
-    } else if (token == '!') {
+      break;
+    } else if (tk == '!') {
       // parse '!='
-      if (*src == '=') {
-        src++;
-        token = Ne;
+      if (*p == '=') {
+        p++;
+        tk = Ne;
       }
-      return;
-    } else if (token == '<') {
-      // parse '<=', '<<' or '<'
-      if (*src == '=') {
-        src ++;
-        token = Le;
-      } else if (*src == '<') {
-        src ++;
-        token = Shl;
+      break;
+    } else if (tk == '<') {
+      // parse '<=', '<<', '<<=' or '<'
+      if (*p == '=') {
+        p ++;
+        tk = Le;
+      } else if (*p == '<') {
+        p ++;
+        tk = Shl;
+        if (*p == '=') {
+          p ++;
+          tk = ShlAssign;
+        }
       } else {
-        token = Lt;
+        tk = Lt;
       }
-      return;
-    } else if (token == '>') {
-      // parse '>=', '>>' or '>'
-      if (*src == '=') {
-        src ++;
-        token = Ge;
-      } else if (*src == '>') {
-        src ++;
-        token = Shr;
+      break;
+    } else if (tk == '>') {
+      // parse '>=', '>>', '>>=' or '>'
+      if (*p == '=') {
+        p ++;
+        tk = Ge;
+      } else if (*p == '>') {
+        p ++;
+        tk = Shr;
+        if (*p == '=') {
+          p ++;
+          tk = ShrAssign;
+        }
       } else {
-        token = Gt;
+        tk = Gt;
       }
-      return;
-    } else if (token == '|') {
-      // parse '|' or '||'
-      if (*src == '|') {
-        src ++;
-        token = Lor;
+      break;
+    } else if (tk == '|') {
+      // parse '|', '||' or '|='
+      if (*p == '|') {
+        p ++;
+        tk = Lor;
+      } else if (*p == '=') {
+        p ++;
+        tk = OrAssign;
       } else {
-        token = Or;
+        tk = Or;
       }
-      return;
-    } else if (token == '&') {
-      // parse '&' and '&&'
-      if (*src == '&') {
-        src ++;
-        token = Lan;
+      break;
+    } else if (tk == '&') {
+      // parse '&', '&&' and '&='
+      if (*p == '&') {
+        p ++;
+        tk = Lan;
+      } else if (*p == '=') {
+        p ++;
+        tk = AndAssign;
       } else {
-        token = And;
+        tk = And;
       }
-      return;
-    } else if (token == '^') {
-      token = Xor;
-      return;
-    } else if (token == '%') {
-      token = Mod;
-      return;
-    } else if (token == '*') {
-      token = Mul;
-      return;
-    } else if (token == '[') {
-      token = Brak;
-      return;
-    } else if (token == '?') {
-      token = Cond;
-      return;
-    } else if (token == '~' || token == ';' || token == '{' || token == '}' || token == '(' || token == ')' || token == ']' || token == ',' || token == ':') {
+      break;
+    } else if (tk == '^' || tk == '%' || tk == '*') {
+      // parse the operator and its compound assignment
+      tk = (tk == '^') ? Xor : (tk == '%') ? Mod : Mul;
+      if (*p == '=') {
+        p++;
+        tk = (tk == Xor) ? XorAssign : (tk == Mod) ? ModAssign : MulAssign;
+      }
+      break;
+    } else if (tk == '[') {
+      tk = Brak;
+      break;
+    } else if (tk == '?') {
+      tk = Cond;
+      break;
+    } else if (tk == '.') {
+      if (*p >= '0' && *p <= '9') {
+        // floating point without integer part (.5)
+        v = double_bits(strtod(*start, &p));
+        tk = Fnum;
+        break;
+      }
+      tk = Dot;
+      break;
+    } else if (tk == '~' || tk == ';' || tk == '{' || tk == '}' || tk == '(' || tk == ')' || tk == ']' || tk == ',' || tk == ':') {
       // directly return the character as token;
+      break;
+    }
+  }
+
+  *s = p;
+  if (tk == Num || tk == Fnum || tk == Id) {
+    *value = v;
+  }
+  return tk;
+}
+
+/**
+  * find the identifier `name` of `length` characters and hash `hash` in
+  * the symbol table, add it when it is new.
+  */
+int *lookup(char *name, int length, int hash) {
+  int *id;
+  int i;
+
+  stats_lookups++;
+  i = hash & id_mask;
+  while ((id = (int*)id_index[i])) {
+    if (id[Hash] == hash && !memcmp((char*)id[Name], name, length)) {
+      return id;
+    }
+    i = (i + 1) & id_mask;
+  }
+
+  // not find and store new id, an empty entry always ends the table
+  if ((symbol_end + 2 * IdSize - symbols) * sizeof(int) > poolsize) {
+    printf("%d: too many identifiers\n", line);
+    exit(-1);
+  }
+  stats_inserts++;
+  id = symbol_end;
+  id_index[i] = (int)id;
+  symbol_end = symbol_end + IdSize;
+  id[Name] = (int)name;
+  id[Hash] = hash;
+  id[Token] = Id;
+  return id;
+}
+
+/**
+  * length of the name of identifier `id`, names point into the source.
+  */
+int name_length(int *id) {
+  char *name, *end;
+
+  name = end = (char*)id[Name];
+  while ((*end >= 'a' && *end <= 'z') || (*end >= 'A' && *end <= 'Z') || (*end >= '0' && *end <= '9') || (*end == '_')) {
+    end++;
+  }
+  return end - name;
+}
+
+/**
+  * copy the string literal at `p` into data, up to its closing quote.
+  */
+void store_string(char *p) {
+  p++;
+  token_val = (int)data;
+  while (*p != 0 && *p != '"') {
+    *data = *p++;
+    if (*data == '\\') {
+      // escape charater
+      *data = *p++;
+      if (*data == 'n') {
+        *data = '\n';
+      }
+    }
+    data++;
+  }
+}
+
+/**
+  * get next token, the function will ignore black character.
+  */
+void next_token() {
+  char *start;
+  int value;
+
+  if (token_pos) {
+    // cursor over the tokens lexed up front
+    if (token_pos == token_end) {
+      token = 0;
       return;
     }
+    token = token_pos[LexKind];
+    line = token_pos[LexLine];
+    if (token == Id) {
+      current_id = symbols + token_pos[LexValue] * IdSize;
+      token = current_id[Token];
+    } else if (token == '"') {
+      store_string(old_src + token_pos[LexValue]);
+    } else if (token == Num || token == Fnum) {
+      token_val = token_pos[LexValue];
+    }
+    token_pos = token_pos + LexSize;
+  } else {
+    token = scan(&src, &value, &start, &line);
+    if (token == Id) {
+      current_id = lookup(start, src - start, value);
+      token = current_id[Token];
+    } else if (token == '"') {
+      store_string(start);
+    } else if (token == Num || token == Fnum) {
+      token_val = value;
+    }
   }
-  return;
+  if (token == Fnum && sizeof(int) < sizeof(double)) {
+    printf("%d: floating point literal needs int of %d bytes\n", line, sizeof(double));
+    exit(-1);
+  }
+}
+
+/**
+  * read the next token into `token`, timed for `-stats`.
+  */
+void next() {
+  int64_t start;
+
+  stats_tokens++;
+  if (stats) {
+    start = stats_clock();
+    next_token();
+    stats_phases[StatLex] = stats_phases[StatLex] + stats_clock() - start - stats_overhead;
+  } else {
+    next_token();
+  }
+}
+
+/**
+  * lex the chunk of source described by `arg` into its part of `tokens`.
+  */
+void *lex_chunk(void *arg) {
+  int *chunk, *out;
+  char *p, *end, *start;
+  int tk, value, lines;
+
+  chunk = arg;
+  p = (char*)chunk[ChunkStart];
+  end = (char*)chunk[ChunkEnd];
+  out = (int*)chunk[ChunkTokens];
+  lines = 0;
+  while (p < end) {
+    tk = scan(&p, &value, &start, &lines);
+    if (!tk || start >= end) {
+      // scanned into the next chunk
+      break;
+    }
+    out[LexKind] = tk;
+    out[LexLine] = lines;
+    // identifiers are looked up in order after all chunks are done
+    out[LexValue] = (tk == Id || tk == '"') ? start - old_src : value;
+    out = out + LexSize;
+  }
+  chunk[ChunkCount] = (out - (int*)chunk[ChunkTokens]) / LexSize;
+
+  // line breaks after the last token count too
+  lines = 0;
+  p = (char*)chunk[ChunkStart];
+  while (p < end) {
+    if (*p++ == '\n') {
+      lines++;
+    }
+  }
+  chunk[ChunkLines] = lines;
+  return 0;
+}
+
+/**
+  * lex the whole source at `src` into `tokens` on `lex_threads` threads
+  * and point next() at it. return the number of tokens.
+  */
+int lex_all() {
+  pthread_t *threads;
+  int *chunks, *chunk, *in, *out;
+  char *p, *end, *name;
+  int i, k, size, base, hash;
+
+  size = strlen(src);
+  chunks = malloc(lex_threads * ChunkSize * sizeof(int));
+  threads = malloc(lex_threads * sizeof(pthread_t));
+  if (!(tokens = malloc((size + lex_threads) * LexSize * sizeof(int)))) {
+    printf("could not malloc (%d) for tokens\n", (size + lex_threads) * LexSize * sizeof(int));
+    exit(-1);
+  }
+
+  // cut at line breaks, no token spans one except inside a string
+  // literal which C doesn't allow, each chunk gets room for a token per
+  // character
+  p = src;
+  i = 0;
+  while (i < lex_threads) {
+    chunk = chunks + i * ChunkSize;
+    end = (i == lex_threads - 1) ? src + size : src + size / lex_threads * (i + 1);
+    if (end < p) {
+      end = p;
+    }
+    while (*end && end > p && end[-1] != '\n') {
+      end++;
+    }
+    chunk[ChunkStart] = (int)p;
+    chunk[ChunkEnd] = (int)end;
+    chunk[ChunkTokens] = (int)(tokens + (p - src + i) * LexSize);
+    if (pthread_create(threads + i, 0, lex_chunk, chunk)) {
+      lex_chunk(chunk);
+      threads[i] = 0;
+    }
+    p = end;
+    i++;
+  }
+
+  // join the chunks in order, offset their lines and look up identifiers
+  out = tokens;
+  base = line;
+  i = 0;
+  while (i < lex_threads) {
+    chunk = chunks + i * ChunkSize;
+    if (threads[i]) {
+      pthread_join(threads[i], 0);
+    }
+    in = (int*)chunk[ChunkTokens];
+    k = 0;
+    while (k < chunk[ChunkCount]) {
+      out[LexKind] = in[LexKind];
+      out[LexLine] = in[LexLine] + base;
+      out[LexValue] = in[LexValue];
+      if (in[LexKind] == Id) {
+        name = p = old_src + in[LexValue];
+        hash = *p++;
+        while ((*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z') || (*p >= '0' && *p <= '9') || (*p == '_')) {
+          hash = hash * 147 + *p++;
+        }
+        out[LexValue] = (lookup(name, p - name, hash) - symbols) / IdSize;
+      }
+      in = in + LexSize;
+      out = out + LexSize;
+      k++;
+    }
+    base = base + chunk[ChunkLines];
+    i++;
+  }
+
+  token_pos = tokens;
+  token_end = out;
+  free(chunks);
+  free(threads);
+  return (out - tokens) / LexSize;
 }
 
 
@@ -362,31 +862,184 @@ int expr() {
 
 
 int base_type;                // the type of a declaration
+int return_type;              // return type of the function being parsed
 int expr_type;                // the type of an expression
 int index_of_bp;              // index of bp pointer on stack
+__thread int frame_top;       // slots of current frame in use, locals and inlined calls
+__thread int frame_size;      // max slots the current frame needs, operand of ENT
+int inline_size;              // max words of a function to be inlined, 0 to disable
+int inline_count;             // number of inlined call sites
+int dce;                      // eliminate functions unreachable from main
+int dump_text;                // disassemble text segment instead of running
+int jobs;                     // threads generating code, 0 to generate while parsing
+int *gen_jobs;                // functions waiting for code, see gen_all()
+int gen_count;                // number of functions in `gen_jobs`
+
+// fields of function waiting for code, code is relative to base
+enum {GenId, GenBody, GenFrame, GenLine, GenCode, GenLines, GenBase, GenWords, GenSize};
+
+int lazy;                     // skip function bodies, compile them on the first call
+int *lazy_jobs;               // functions whose body is skipped, see lazy_compile()
+int lazy_count;               // number of functions in `lazy_jobs`
+
+// fields of skipped function, the body is parsed again from its parameters
+enum {LazyId, LazySrc, LazyLine, LazySize};
+
+/******************************************************************
+                   +--------+                 +---------+
+-- token stream -->| parser | --> syntax -->  | codegen | --> assembly
+                   +--------+     tree        +---------+
+
+the parser builds the syntax tree of one function body, the code
+generator walks it to emit code into `text`, then the whole tree is
+dropped at once by resetting the arena pointer `ast`.
+
+every node is a small array of int allocated from the arena:
+
+expression nodes: kind | type | operands ...
+  Num             value                     IMM <value>
+  Loc / Glo       offset to bp / address    variable, load by type
+  Deref           expr                      *expr, load by type
+  Field           lvalue, offset            member of a struct, load by type
+  Addr            lvalue                    &lvalue, or an array variable
+  '!' '~' Neg     expr
+  Inc / Dec       lvalue                    ++lvalue, --lvalue
+  PostInc/PostDec lvalue                    lvalue++, lvalue--
+  Assign          lvalue, expr
+  OrAssign ...    lvalue, expr              lvalue op= expr, up to ModAssign
+  Cond            cond, expr, expr          cond ? expr : expr
+  Lor ... Mod     expr, expr                binary operators
+  PtrAdd/PtrSub   expr, expr                pointer +/- scaled integer
+  PtrDiff         expr, expr                pointer - pointer, typed as the pointer
+  Fun / Sys / Ext id, count, args ...       function call
+  Func            id                        address of a function
+
+a struct is never loaded, the value of a struct lvalue is its address.
+
+statement nodes: kind | next statement | line | operands ...
+  If              cond, statement, else statement or 0
+  While           cond, statement
+  Return          expr or 0
+  '{'             first statement of the block or 0
+  ';'             expr
+*******************************************************************/
+int *ast, *old_ast;           // syntax tree arena, bump pointer and its base
+int *ast_end;                 // end of the arena
+
+// kinds of syntax tree node besides the tokens
+enum {Deref = Arrow + 1, Addr, Neg, PostInc, PostDec, PtrAdd, PtrSub, PtrDiff, Field, Func, Itof, Ftoi};
+
+/**
+  * allocate a node of `size` words from the arena.
+  */
+int *new_node(int size) {
+  int *node;
+
+  node = ast;
+  ast = ast + size;
+  if (ast > ast_end) {
+    printf("%d: function too large for syntax tree\n", line);
+    exit(-1);
+  }
+  return node;
+}
+
+/**
+  * allocate an expression node with at most two operands.
+  */
+int *expression_node(int kind, int type, int *a, int *b) {
+  int *node;
+
+  node = new_node(4);
+  node[0] = kind;
+  node[1] = type;
+  node[2] = (int)a;
+  node[3] = (int)b;
+  return node;
+}
+
+/**
+  * whether `node` is an expression that can be assigned to.
+  */
+int is_lvalue(int *node) {
+  return node[0] == Loc || node[0] == Glo || node[0] == Deref || node[0] == Field;
+}
+
+int type_specifier();
+int complete_size(int type);
+
+/**
+  * convert `node` of type `from` to type `to` where one of them is double.
+  */
+int *convert(int *node, int from, int to) {
+  if ((from == DOUBLE) == (to == DOUBLE)) {
+    return node;
+  }
+  if (from >= PTR || to >= PTR || is_struct(from) || is_struct(to)) {
+    printf("%d: bad conversion of double\n", line);
+    exit(-1);
+  }
+  return expression_node((to == DOUBLE) ? Itof : Ftoi, to, node, 0);
+}
+
+/**
+  * `node` tested for truth, a double is compared with 0.0 instead of
+  * testing its bits, which are not 0 for -0.0.
+  */
+int *condition(int *node) {
+  if (node[1] != DOUBLE) {
+    return node;
+  }
+  return expression_node(Ne, INT, node, expression_node(Num, DOUBLE, (int*)double_bits(0.0), 0));
+}
+
+/**
+  * node of binary operator `kind` on `a` of type `ta` and `b` of type
+  * expr_type, an arithmetic operator or comparison works on doubles when
+  * either operand is one. the type of the result goes to expr_type.
+  */
+int *binary_node(int kind, int *a, int ta, int *b) {
+  int tb;
+
+  tb = expr_type;
+  if (ta != DOUBLE && tb != DOUBLE) {
+    // comparison and bitwise operators give int
+    expr_type = (kind >= Mul && kind <= Mod) ? ta : INT;
+    return expression_node(kind, expr_type, a, b);
+  }
+  if (!(kind >= Eq && kind <= Ge) && !(kind >= Add && kind <= Div)) {
+    printf("%d: bad operand of double\n", line);
+    exit(-1);
+  }
+  a = convert(a, ta, DOUBLE);
+  b = convert(b, tb, DOUBLE);
+  expr_type = (kind >= Eq && kind <= Ge) ? INT : DOUBLE;
+  return expression_node(kind, expr_type, a, b);
+}
 
 /**
   * parse expression.
   */
-void expression(int level) {
+int *expression(int level) {
   // unit_unary()
-  int *id, *addr;
-  int tmp;
+  int *id, *node, *args[32];
+  int tmp, i;
   if (!token) {
     printf("%d: unexpected token EOF of expression\n", line);
     exit(-1);
   }
   if (token == Num) {
     match(Num);
-    // emit code
-    *++text = IMM;
-    *++text = token_val;
+    node = expression_node(Num, INT, (int*)token_val, 0);
     expr_type = INT;
   }
+  else if (token == Fnum) {
+    match(Fnum);
+    node = expression_node(Num, DOUBLE, (int*)token_val, 0);
+    expr_type = DOUBLE;
+  }
   else if (token == '"') {
-    // emit code
-    *++text = IMM;
-    *++text = token_val;
+    node = expression_node(Num, PTR, (int*)token_val, 0);
 
     match('"');
     // store the rest strings
@@ -404,23 +1057,26 @@ void expression(int level) {
     match('(');
     expr_type = INT;
 
-    if (token == Int) {
-      match(Int);
-    } else if (token == Char) {
-      match(Char);
-      expr_type = CHAR;
-    }
+    if (token == Id && (current_id[Class] == Loc || current_id[Class] == Glo)) {
+      // size of variable, the whole of an array
+      id = current_id;
+      match(Id);
+      tmp = id[Size] ? id[Size] : type_size(id[Type]);
+    } else {
+      if (token == Int || token == Char || token == Struct || token == Double) {
+        expr_type = type_specifier();
+      }
 
-    while (token == Mul) {
-      match(Mul);
-      expr_type = expr_type + PTR;
+      while (token == Mul) {
+        match(Mul);
+        expr_type = expr_type + PTR;
+      }
+      tmp = complete_size(expr_type);
     }
 
     match(')');
 
-    // emit code
-    *++text = IMM;
-    *++text = (expr_type == CHAR) ? sizeof(char) : sizeof(int);
+    node = expression_node(Num, INT, (int*)tmp, 0);
 
     expr_type = INT;
   }
@@ -435,9 +1091,11 @@ void expression(int level) {
       // pass in arguments
       tmp = 0;              // number of arguments
       while (token != ')') {
-        expression(Assign);
-        *++text = PUSH;
-        tmp++;
+        if (tmp == 32) {
+          printf("%d: too many arguments\n", line);
+          exit(-1);
+        }
+        args[tmp++] = expression(Assign);
 
         if (token == ',') {
           match(',');
@@ -445,76 +1103,85 @@ void expression(int level) {
       }
       match(')');
 
-      // emit code
-      if (id[Class] == Sys) {
-        // system functions
-        *++text = id[Value];
-      }
-      else if (id[Class] == Fun) {
-        // function call
-        *++text = CALL;
-        *++text = id[Value];
-      } else {
+      if (id[Class] != Sys && id[Class] != Fun && id[Class] != Ext) {
         printf("%d: bad function call\n", line);
         exit(-1);
       }
+      if (id[Class] == Ext && tmp != id[Params]) {
+        // arguments are taken from the stack by the declared number
+        printf("%d: native function takes %d arguments\n", line, id[Params]);
+        exit(-1);
+      }
 
-      // clean the stack for arguments
-      if (tmp > 0) {
-        *++text = ADJ;
-        *++text = tmp;
+      node = new_node(4 + tmp);
+      node[0] = id[Class];
+      node[1] = id[Type];
+      node[2] = (id[Class] == Sys) ? id[Value] : (int)id;
+      node[3] = tmp;
+      i = 0;
+      while (i < tmp) {
+        if (id[Class] != Sys && i < id[Params]) {
+          // passed as the type of the parameter
+          args[i] = convert(args[i], args[i][1], (id[Doubles] & (1 << i)) ? DOUBLE : INT);
+        }
+        node[4 + i] = (int)args[i];
+        i++;
       }
       expr_type = id[Type];
     }
     else if (id[Class] == Num) {
       // enum variable
-      *++text = IMM;
-      *++text = id[Value];
+      node = expression_node(Num, INT, (int*)id[Value], 0);
+      expr_type = INT;
+    }
+    else if (id[Class] == Fun) {
+      // function name without call, its address as for spawn()
+      node = expression_node(Func, INT, id, 0);
       expr_type = INT;
     } else {
       // variable
       if (id[Class] == Loc) {
-        *++text = LEA;
-        *++text = index_of_bp - id[Value];
+        node = expression_node(Loc, id[Type], (int*)(index_of_bp - id[Value]), 0);
       }
       else if (id[Class] == Glo) {
-        *++text = IMM;
-        *++text = id[Value];
+        node = expression_node(Glo, id[Type], (int*)id[Value], 0);
       } else {
         printf("%d: undefined variable\n", line);
         exit(-1);
       }
 
-      // emit code, default behaviour is to liad the value of the 
-      // address which is store in `ax`
+      // default behaviour is to load the value of the variable, an
+      // array is the address of its first element instead
+      if (id[Size] && id[Type] >= PTR) {
+        node = expression_node(Addr, id[Type], node, 0);
+      }
       expr_type = id[Type];
-      *++text = (expr_type == Char) ? LC : LI;
     }
   }
   else if (token == '(') {
     // cast or parenthesis
     match('(');
-    if (token == Int || token == Char) {
-      tmp = (token == Char) ? CHAR : INT;
-      match(token);
+    if (token == Int || token == Char || token == Struct || token == Double) {
+      tmp = type_specifier();
       while (token == Mul) {
         match(Mul);
         tmp = tmp + PTR;
       }
       match(')');
 
-      expression(Inc);        // cast has precedence as Inc(++)
+      node = expression(Inc); // cast has precedence as Inc(++)
+      node = convert(node, expr_type, tmp);
 
       expr_type = tmp;
     } else {
-      expression(Assign);
+      node = expression(Assign);
       match(')');
     }
   }
   else if (token == Mul) {
     // dereference *<addr>
     match(Mul);
-    expression(Inc);
+    node = expression(Inc);
 
     if (expr_type >= PTR) {
       expr_type = expr_type - PTR;
@@ -523,94 +1190,71 @@ void expression(int level) {
       exit(-1);
     }
 
-    *++text = (expr_type == CHAR) ? LC : LI;
+    node = expression_node(Deref, expr_type, node, 0);
   }
   else if (token == And) {
     // get the address of variable
     match(And);
-    expression(Inc);
+    node = expression(Inc);
 
-    if (*text == LC || *text == LI) {
-      text--;
-    } else {
+    if (!is_lvalue(node)) {
       printf("%d: bad address of\n", line);
       exit(-1);
     }
 
     expr_type = expr_type + PTR;
+    node = expression_node(Addr, expr_type, node, 0);
   }
   else if (token == '!') {
     // logical operate
     match('!');
-    expression(Inc);
-
-    // emit code use <expr> == 0
-    *++text = PUSH;
-    *++text = IMM;
-    *++text = 0;
-    *++text = EQ;
-
+    node = expression_node('!', INT, condition(expression(Inc)), 0);
     expr_type = INT;
   }
   else if (token == '~') {
     // bitwise not
     match('~');
-    expression(Inc);
-
-    // emit code use <expr> XOR -1
-    *++text = PUSH;
-    *++text = IMM;
-    *++text = -1;
-    *++text = XOR;
-
-    expr_type = INT;
+    node = expression(Inc);
+    if (expr_type == DOUBLE) {
+      printf("%d: bad operand of double\n", line);
+      exit(-1);
+    }
+    node = expression_node('~', INT, node, 0);
+    expr_type = INT;
   }
   else if (token == Add) {
-    // +var do nothing
+    // +var do nothing, the type stays that of var
     match(Add);
-    expression(Inc);
-
-    expr_type = INT;
+    node = expression(Inc);
   }
   else if (token == Sub) {
     // -var
     match(Sub);
 
     if (token == Num) {
-      *++text == IMM;
-      *++text == -token_val;
+      node = expression_node(Num, INT, (int*)-token_val, 0);
       match(Num);
+      expr_type = INT;
+    } else if (token == Fnum) {
+      node = expression_node(Num, DOUBLE, (int*)double_bits(-bits_double(token_val)), 0);
+      match(Fnum);
+      expr_type = DOUBLE;
     } else {
-      *++text = IMM;
-      *++text = -1;
-      *++text = PUSH;
-      expression(Inc);
-      *++text = MUL;
+      node = expression(Inc);
+      expr_type = (expr_type == DOUBLE) ? DOUBLE : INT;
+      node = expression_node(Neg, expr_type, node, 0);
     }
-
-    expr_type = INT;
   }
   else if (token == Inc || token == Dec) {
     tmp = token;
     match(token);
-    expression(Inc);
-
-    if (*text == LC) {
-      *text = PUSH;         // to duplicate the address
-      *++text = LC;
-    } else if (*text == LI) {
-      *text = PUSH;
-      *++text = LI;
-    } else {
+    node = expression(Inc);
+
+    if (!is_lvalue(node)) {
       printf("%d: bad lvalue of pre-increment\n", line);
       exit(-1);
     }
-    *++text = PUSH;
-    *++text = IMM;
-
-    *++text = (expr_type > PTR) ? sizeof(int) : sizeof(char);
-    *++text = (tmp == Inc) ? ADD : SUB;
-    *++text = (expr_type == CHAR) ? SC : SI;
+    node = expression_node(tmp, expr_type, node, 0);
   }
   else {
     printf("%d: bad expression\n", line);
@@ -623,23 +1267,48 @@ void expression(int level) {
     if (token == Assign) {
       // var = expr;
       match(Assign);
-      if (*text == LC || *text == LI) {
-        *text = PUSH;         // save the lvalue pointer
-      } else {
+      if (!is_lvalue(node)) {
         printf("%d: bad lvalue in assignment\n", line);
         exit(-1);
       }
-      expression(Assign);
+      if (is_struct(tmp)) {
+        printf("%d: struct assignment not supported\n", line);
+        exit(-1);
+      }
+      id = expression(Assign);
+      node = expression_node(Assign, tmp, node, convert(id, expr_type, tmp));
+
+      expr_type = tmp;
+    }
+    else if (token >= OrAssign && token <= ModAssign) {
+      // var op= expr, the address of var is computed once
+      i = token;
+      match(token);
+      if (!is_lvalue(node) || is_struct(tmp)) {
+        printf("%d: bad lvalue in compound assignment\n", line);
+        exit(-1);
+      }
+      if (tmp >= PTR && i != AddAssign && i != SubAssign) {
+        printf("%d: bad compound assignment to pointer\n", line);
+        exit(-1);
+      }
+      id = expression(Assign);
+      if ((tmp == DOUBLE || expr_type == DOUBLE) && (tmp >= PTR || i < AddAssign || i == ModAssign)) {
+        printf("%d: bad operand of double\n", line);
+        exit(-1);
+      }
+      // an int lvalue and a double operand are operated on as double
+      node = expression_node(i, tmp, node, convert(id, expr_type, (tmp == DOUBLE) ? DOUBLE : expr_type));
 
       expr_type = tmp;
-      *++text = (expr_type == CHAR) ? SC : SI;
     }
     else if (token == Cond) {
       // expr ? a : b;
       match(Cond);
-      *++text = JZ;
-      addr = ++text;
-      expression(Assign);
+      id = new_node(5);
+      id[0] = Cond;
+      id[2] = (int)condition(node);
+      id[3] = (int)expression(Assign);
       if (token == ':') {
         match(':');
       } else {
@@ -647,242 +1316,205 @@ void expression(int level) {
         exit(-1);
       }
 
-      *addr = (int)(text + 3);
-      *++text = JMP;
-      addr = ++text;
-      expression(Cond);
-      *addr = (int)(text + 1);
+      i = ((int*)id[3])[1];
+      id[4] = (int)expression(Cond);
+      if (i == DOUBLE || expr_type == DOUBLE) {
+        id[3] = (int)convert((int*)id[3], i, DOUBLE);
+        id[4] = (int)convert((int*)id[4], expr_type, DOUBLE);
+        expr_type = DOUBLE;
+      }
+      id[1] = expr_type;
+      node = id;
     }
     else if (token == Lor) {
       // logical or
       match(Lor);
-      *++text = JNZ;
-      addr = ++text;
-      expression(Lan);
-      *addr = (int)(text + 1);
+      node = expression_node(Lor, INT, condition(node), condition(expression(Lan)));
       expr_type = INT;
     }
     else if (token == Lan) {
       // logical and
       match(Lan);
-      *++text = JZ;
-      addr = ++text;
-      expression(Or);
-      *addr = (int)(text + 1);
+      node = expression_node(Lan, INT, condition(node), condition(expression(Or)));
       expr_type = INT;
     }
     else if (token == Or) {
       // bitwise or
       match(Or);
-      *++text = PUSH;
-      expression(Xor);
-      *++text = OR;
-      expr_type = INT;
+      node = binary_node(Or, node, tmp, expression(Xor));
     }
     else if (token == Xor) {
       // bitwise xor
       match(Xor);
-      *++text = PUSH;
-      expression(And);
-      *++text = XOR;
-      expr_type = INT;
+      node = binary_node(Xor, node, tmp, expression(And));
     }
     else if (token == And) {
       // bitwise and
       match(And);
-      *++text = PUSH;
-      expression(Eq);
-      *++text = AND;
-      expr_type = INT;
+      node = binary_node(And, node, tmp, expression(Eq));
     }
     else if (token == Eq) {
       // equal ==
       match(Eq);
-      *++text = PUSH;
-      expression(Ne);
-      *++text = EQ;
-      expr_type = INT;
+      node = binary_node(Eq, node, tmp, expression(Ne));
     }
     else if (token == Ne) {
       // not equal !=
       match(Ne);
-      *++text = PUSH;
-      expression(Lt);
-      *++text = NE;
-      expr_type = INT;
+      node = binary_node(Ne, node, tmp, expression(Lt));
     }
     else if (token == Lt) {
       // less than
       match(Lt);
-      *++text = PUSH;
-      expression(Shl);
-      *++text = LT;
-      expr_type = INT;
+      node = binary_node(Lt, node, tmp, expression(Shl));
     }
     else if (token == Gt) {
       // greater than
       match(Gt);
-      *++text = PUSH;
-      expression(Shl);
-      *++text = GT;
-      expr_type = INT;
+      node = binary_node(Gt, node, tmp, expression(Shl));
     }
     else if (token == Le) {
       // less or equal
       match(Le);
-      *++text = PUSH;
-      expression(Shl);
-      *++text = LE;
-      expr_type = INT;
+      node = binary_node(Le, node, tmp, expression(Shl));
     }
     else if (token == Ge) {
       // greater or equal
       match(Ge);
-      *++text = PUSH;
-      expression(Shl);
-      *++text = GE;
-      expr_type = INT;
+      node = binary_node(Ge, node, tmp, expression(Shl));
     }
     else if (token == Shl) {
       // shift left
       match(Shl);
-      *++text = PUSH;
-      expression(Add);
-      *++text = SHL;
-      expr_type = INT;
+      node = binary_node(Shl, node, tmp, expression(Add));
     }
     else if (token == Shr) {
       // shift right
       match(Shr);
-      *++text = PUSH;
-      expression(Add);
-      *++text = SHR;
-      expr_type = INT;
+      node = binary_node(Shr, node, tmp, expression(Add));
     }
     else if (token == Add) {
       // add
       match(Add);
-      *++text = PUSH;
-      expression(Mul);
+      id = expression(Mul);
 
-      expr_type = tmp;
-      if (expr_type > PTR) {
+      if (tmp == DOUBLE || expr_type == DOUBLE) {
+        node = binary_node(Add, node, tmp, id);
+      } else {
+        expr_type = tmp;
         // pointer type, and not char *
-        *++text = PUSH;
-        *++text = IMM;
-        *++text = sizeof(int);
-        *++text = MUL;
+        node = expression_node((expr_type > PTR) ? PtrAdd : Add, expr_type, node, id);
       }
-      *++text = ADD;
     }
     else if (token == Sub) {
       // sub
       match(Sub);
-      *++text = PUSH;
-      expression(Mul);
-      if (tmp > PTR && tmp == expr_type) {
+      id = expression(Mul);
+      if (tmp == DOUBLE || expr_type == DOUBLE) {
+        node = binary_node(Sub, node, tmp, id);
+      }
+      else if (tmp > PTR && tmp == expr_type) {
         // pointer subtraction
-        *++text = SUB;
-        *++text = PUSH;
-        *++text = IMM;
-        *++text = sizeof(int);
-        *++text = DIV;
+        node = expression_node(PtrDiff, tmp, node, id);
         expr_type = INT;
       }
-      else if (expr_type > PTR) {
+      else if (tmp > PTR) {
         // pointer movement
-        *++text = PUSH;
-        *++text = IMM;
-        *++text = sizeof(int);
-        *++text = MUL;
-        *++text = SUB;
+        node = expression_node(PtrSub, tmp, node, id);
         expr_type = tmp;
       } else {
         // numeral subtraction
-        *++text = SUB;
+        node = expression_node(Sub, tmp, node, id);
         expr_type = tmp;
       }
     }
     else if (token == Mul) {
       // multiply
       match(Mul);
-      *++text = PUSH;
-      expression(Inc);
-      *++text = MUL;
-      expr_type = tmp;
+      node = binary_node(Mul, node, tmp, expression(Inc));
     }
     else if (token == Div) {
       // divide
       match(Div);
-      *++text = PUSH;
-      expression(Inc);
-      *++text = DIV;
-      expr_type = tmp;
+      node = binary_node(Div, node, tmp, expression(Inc));
     }
     else if (token == Mod) {
       // modulo
       match(Mod);
-      *++text = PUSH;
-      expression(Inc);
-      *++text = MOD;
-      expr_type = tmp;
+      node = binary_node(Mod, node, tmp, expression(Inc));
     }
     else if (token == Inc || token == Dec) {
       // postfix inc(++) and dec(--)
       // we will increase the value to the variable and decrease it
       // on `ax` to get its original value
-      if (*text == LI) {
-        *text = PUSH;
-        *++text = LI;
-      }
-      else if (*text == LC) {
-        *text = PUSH;
-        *++text = LC;
-      }
-      else {
+      if (!is_lvalue(node)) {
         printf("%d: bad value in increment\n", line);
         exit(-1);
       }
-
-      *++text = PUSH;
-      *++text = IMM;
-
-      *++text = (expr_type > PTR) ? sizeof(int) : sizeof(char);
-      *++text = (token == Inc) ? ADD : SUB;
-      *++text = (expr_type == CHAR) ? SC : SI;
-      *++text = PUSH;
-      *++text = IMM;
-      *++text = (expr_type > PTR) ? sizeof(int) : sizeof(char);
-      *++text = (token == Inc) ? SUB : ADD;\
+      node = expression_node((token == Inc) ? PostInc : PostDec, expr_type, node, 0);
       match(token);
     }
     else if (token == Brak) {
       // array access var[xx]
       match(Brak);
-      *++text = PUSH;
-      expression(Assign);
+      id = expression(Assign);
       match(']');
 
-      if (tmp > PTR) {
-        // pointer, `not char *`
-        *++text = PUSH;
-        *++text = IMM;
-        *++text = sizeof(int);
-        *++text = MUL;
-      }
-      else if (tmp < PTR) {
+      if (tmp < PTR) {
         printf("%d: pointer type expected\n", line);
         exit(-1);
       }
+      // pointer, `not char *`
+      node = expression_node((tmp > PTR) ? PtrAdd : Add, tmp, node, id);
       expr_type = tmp - PTR;
-      *++text = ADD;
-      *++text = (expr_type == CHAR) ? LC : LI;
+      node = expression_node(Deref, expr_type, node, 0);
+    }
+    else if (token == Dot || token == Arrow) {
+      // struct member s.xx, p->xx is (*p).xx
+      if (token == Arrow) {
+        if (!is_struct(tmp - PTR)) {
+          printf("%d: pointer to struct expected\n", line);
+          exit(-1);
+        }
+        tmp = tmp - PTR;
+        node = expression_node(Deref, tmp, node, 0);
+      }
+      else if (!is_struct(tmp) || !is_lvalue(node)) {
+        printf("%d: struct expected\n", line);
+        exit(-1);
+      }
+      match(token);
+
+      i = 0;
+      while (i < member_count && (members[i * MemberSize + MemberStruct] != tmp
+                                  || members[i * MemberSize + MemberId] != (int)current_id)) {
+        i++;
+      }
+      if (token != Id || i == member_count) {
+        printf("%d: bad struct member\n", line);
+        exit(-1);
+      }
+      match(Id);
+      id = members + i * MemberSize;
+      expr_type = id[MemberType];
+
+      // one base and one offset, however deep the member is nested
+      if (node[0] == Field) {
+        node = expression_node(Field, expr_type, (int*)node[2], (int*)(node[3] + id[MemberOffset]));
+      } else {
+        node = expression_node(Field, expr_type, node, (int*)id[MemberOffset]);
+      }
+      if (id[MemberBytes]) {
+        // array member
+        node = expression_node(Addr, expr_type, node, 0);
+      }
     }
     else {
       printf("%d: compiler error, token = %d\n", line, token);
       exit(-1);
     }
   }
+  return node;
 }
 
 void match(int tk) {
@@ -906,7 +1538,7 @@ int demo(int param_a, int *param_b) {
              +------------------+
 high address |    arg: param_a  |   new_bp + 3
              +------------------+
-             |    arg: param_b  |   new_bp + 2 
+             |    arg: param_b  |   new_bp + 2
              +------------------+
              |  return address  |   new_bp + 1
              +------------------+
@@ -919,82 +1551,71 @@ low address  |      local_2     |   new_bp - 2
              |      ......      |
 
 *******************************************************************/
-void statement() {
-  int* a, *b;
-  // if (...) <statement> [else <statement>]
-  //    if (<cond>)               <cond>
-  //                              JZ a
-  //      <true_statement>        <true_statement>
-  //    else                      JMP b
-  //  a:  
-  //      <false_statement>       <false_statement>
-  //  b:
+/**
+  * allocate a statement node with `size` words of operands.
+  */
+int *statement_node(int kind, int size) {
+  int *node;
+
+  node = new_node(3 + size);
+  memset(node, 0, (3 + size) * sizeof(int));
+  node[0] = kind;
+  node[2] = line;
+  return node;
+}
+
+int *statement() {
+  int *node, *last, *tmp;
 
   if (token == If) {
+    // if (<cond>) <statement> [else <statement>]
     match(If);
     match('(');
-    expression(Assign);         // parse condition
+    node = statement_node(If, 3);
+    node[3] = (int)condition(expression(Assign));   // parse condition
     match(')');
 
-    *++text = JZ;
-    b = ++text;
-
-    statement();                // parse statement
+    node[4] = (int)statement();         // parse statement
     if (token == Else) {
       match(Else);
-
-      // emit code for JMP b
-      *b = (int)(text + 3);
-      *++text = JMP;
-      b = ++text;
-
-      statement();
+      node[5] = (int)statement();
     }
-
-    *b = (int)(text + 1);
   }
 
-  // a: 
-  //    while (<cond>)              <cond>
-  //                                JZ b
-  //      <statement>               <statement>
-  //                                JMP a
-  // b:
-  
   else if (token == While) {
+    // while (<cond>) <statement>
     match(While);
-    a = text + 1;
     match('(');
-    expression(Assign);
+    node = statement_node(While, 2);
+    node[3] = (int)condition(expression(Assign));
     match(')');
-    *++text = JZ;
-    b = ++text;
-
-    statement();
 
-    *++text = JMP;
-    *++text = (int)a;
-    *b = (int)(text + 1);
+    node[4] = (int)statement();
   }
 
   else if (token == Return) {
     match(Return);
+    node = statement_node(Return, 1);
     if (token != ';') {
-      expression(Assign);
+      node[3] = (int)expression(Assign);
+      node[3] = (int)convert((int*)node[3], expr_type, return_type);
     }
 
     match(';');
-
-    //  emit code for return
-    *++text = LEV;
   }
 
   else if (token == '{') {
     // { <statement> ...
     match('{');
+    node = statement_node('{', 1);
 
+    // chain the statements through `next`
+    last = node + 3;
     while (token != '}') {
-      statement();
+      if ((tmp = statement())) {
+        *last = (int)tmp;
+        last = tmp + 1;
+      }
     }
     match('}');
   }
@@ -1002,263 +1623,3336 @@ void statement() {
   else if (token == ';') {
     // empty statement
     match(';');
+    node = 0;
   }
 
   else {
     // a = b; or function_call();
-    expression(Assign);
+    node = statement_node(';', 1);
+    node[3] = (int)expression(Assign);
     match(';');
   }
+  return node;
 }
 
-void function_parameter() {
-  int type;
-  int params = 0;             // index of current parameter
-  while (token != ')') {
-    // int name, ...
-    type = INT;
-    if (token == INT) {
-      match(Int);
-    } else if (token == Char) {
-      type = CHAR;
-      match(Char);
-    }
+/******************************************************************
+code generator, walk the syntax tree and emit code into `text`.
+*******************************************************************/
 
-    // pointer type
-    while (token == Mul) {
-      match(Mul);
-      type = type + PTR;
-    }
+/**
+  * instruction of compound assignment `kind`.
+  */
+int compound_op(int kind) {
+  if (kind == OrAssign)  return OR;
+  if (kind == XorAssign) return XOR;
+  if (kind == AndAssign) return AND;
+  if (kind == ShlAssign) return SHL;
+  if (kind == ShrAssign) return SHR;
+  if (kind == AddAssign) return ADD;
+  if (kind == SubAssign) return SUB;
+  if (kind == MulAssign) return MUL;
+  if (kind == DivAssign) return DIV;
+  return MOD;
+}
 
-    // parameter name
-    if (token != Id) {
-      printf("%d: bad parameter declaration.\n", line);
-      exit(-1);
-    }
-    if (current_id[Class] == Loc) {
-      printf("%d: duplicate parameter declaration\n", line);
-      exit(-1);
-    }
+void gen_expression(int *node);
 
-    match(Id);
+/**
+  * stop when fewer than `words` words are left in `text`. code generation
+  * checks for 64 words before and after every expression and statement,
+  * no node emits more than that in between.
+  */
+void text_reserve(int words) {
+  if (text + words >= old_text + poolsize / sizeof(int)) {
+    printf("%d: text segment full\n", line);
+    exit(-1);
+  }
+}
 
-    // store the local variable
-    current_id[BClass] = current_id[Class];
-    current_id[Class] = Loc;
-    current_id[BType] = current_id[Type];
-    current_id[Type] = type;
-    current_id[BValue] = current_id[Value];
-    current_id[Value] = params++;
+/**
+  * whether function `id` can be expanded at call site: it is fully
+  * compiled, small enough and never calls itself.
+  */
+int inlinable(int *id) {
+  int *code, *end;
 
-    if (token == ',') {
-      match(',');
+  if (id[Class] != Fun || id[Size] <= 0 || id[Size] > inline_size || *(int*)id[Value] == LAZY) {
+    // a lazy stub has no code to copy yet
+    return 0;
+  }
+
+  code = (int*)id[Value];
+  end = code + id[Size];
+  while (code < end) {
+    if (*code == CALL && code[1] == id[Value]) {
+      return 0;
     }
+    code = code + ((*code <= ADJ) ? 2 : 1);
   }
+  return 1;
+}
 
-  index_of_bp = params + 1;
+/**
+  * map address `addr` inside the inlined body `start` to its copy at `to`,
+  * every LEV in between is grown into a 2-word JMP to the exit.
+  */
+int *inline_address(int *start, int *end, int *to, int *addr) {
+  if (addr > end) {
+    addr = end;
+  }
+  while (start < addr) {
+    if (*start == LEV) {
+      to = to + 2;
+      start = start + 1;
+    } else if (*start <= ADJ) {
+      to = to + 2;
+      start = start + 2;
+    } else {
+      to = to + 1;
+      start = start + 1;
+    }
+  }
+  return to;
 }
 
-void function_body() {
-  // type func_name (...) {...}
+/**
+  * expand call `node` of function `id` in place.
+  *
+  * parameters and locals of the callee are mapped to fresh slots of
+  * the caller's frame, arguments are stored there instead of pushed:
+  *   LEA <slot>; PUSH; <arg>; SI   ...   <body>
+  * every `return` of the body jumps to the end of the expansion.
+  */
+void inline_call(int *id, int *node) {
+  int *code, *start, *end, *to;
+  int base, params, nargs;
 
-  // ... {
-  // 1. local declarations
-  // 2. statements
-  // }
+  params = id[Params];
+  if (node[3] != params) {
+    printf("bad number of arguments to inlined call\n");
+    exit(-1);
+  }
+  text_reserve(64);
 
-  int pos_local;              // position of local variables on the stack
-  int type;
-  pos_local = index_of_bp;
+  base = frame_top;
+  frame_top = frame_top + params + ((int*)id[Value])[1];
+  if (frame_top > frame_size) {
+    frame_size = frame_top;
+  }
 
-  while (token == Int || token == Char) {
-    // local variable declaration, just like global ones
-    base_type = (token == Int) ? INT : CHAR;
-    match(token);
+  // store arguments into the slots of parameters
+  nargs = 0;
+  while (nargs < params) {
+    *++text = LEA;
+    *++text = -(base + nargs + 1);
+    *++text = PUSH;
+    gen_expression((int*)node[4 + nargs]);
+    *++text = SI;
+    nargs++;
+  }
 
-    while (token != ';') {
-      type = base_type;
-      while (token == Mul) {
-        match(Mul);
-        type = type + PTR;
-      }
+  // copy the body without ENT and the trailing LEVs
+  start = (int*)id[Value] + 2;
+  end = start;
+  code = start;
+  while (code < (int*)id[Value] + id[Size]) {
+    if (*code != LEV) {
+      end = code + ((*code <= ADJ) ? 2 : 1);
+    }
+    code = code + ((*code <= ADJ) ? 2 : 1);
+  }
 
-      if (token != Id) {
-        // invalid declaration
-        printf("%d: bad local declaration\n", line);
-        exit(-1);
-      }
-      if (current_id[Class] == Loc) {
-        // identifier exists
-        printf("%d: duplicate local declaration\n", line);
-        exit(-1);
-      }
-      match(Id);
+  // a LEV grows into a JMP of 2 words
+  text_reserve(2 * (end - start) + 64);
+  to = text + 1;
+  code = start;
+  while (code < end) {
+    if (*code == LEV) {
+      *++text = JMP;
+      *++text = (int)inline_address(start, end, to, end);
+      code = code + 1;
+    } else if (*code == LEA) {
+      // parameters are above bp, locals below
+      *++text = LEA;
+      *++text = (code[1] > 1) ? -(base + params + 2 - code[1]) : -(base + params - code[1]);
+      code = code + 2;
+    } else if (*code == JMP || *code == JZ || *code == JNZ) {
+      *++text = *code;
+      *++text = (int)inline_address(start, end, to, (int*)code[1]);
+      code = code + 2;
+    } else if (*code <= ADJ) {
+      *++text = *code++;
+      *++text = *code++;
+    } else {
+      *++text = *code++;
+    }
+  }
 
-      // store the local variable
-      current_id[BClass] = current_id[Class];
-      current_id[Class] = Loc;
-      current_id[BType] = current_id[Type];
-      current_id[Type] = type;
-      current_id[BValue] = current_id[Value];
-      current_id[Value] = ++pos_local;
+  frame_top = base;
+  inline_count++;
+}
 
-      if (token == ',') {
-        match(',');
+/**
+  * emit code leaving the address of lvalue `node` in ax.
+  */
+void gen_address(int *node) {
+  int *base;
+
+  if (node[0] == Loc) {
+    *++text = LEA;
+    *++text = node[2];
+  }
+  else if (node[0] == Glo) {
+    *++text = IMM;
+    *++text = node[2];
+  }
+  else if (node[0] == Field) {
+    // fold the offset into the address of a variable when possible
+    base = (int*)node[2];
+    if (base[0] == Glo) {
+      *++text = IMM;
+      *++text = base[2] + node[3];
+    }
+    else if (base[0] == Loc && node[3] % sizeof(int) == 0) {
+      *++text = LEA;
+      *++text = base[2] + node[3] / sizeof(int);
+    }
+    else {
+      gen_address(base);
+      if (node[3]) {
+        *++text = ADDI;
+        *++text = node[3];
       }
     }
-    match(';');
   }
-
-  // save the stack size for local variables
-  *++text = ENT;
-  *++text = pos_local - index_of_bp;
-
-  // statements
-  while (token != '}') {
-    statement();
+  else {
+    // Deref
+    gen_expression((int*)node[2]);
   }
-
-  // emit code for leaving the sub function
-  *++text = LEV;
 }
 
-void function_declaration() {
-  // type func_name (...) {...}
-  match('(');
-  function_parameter();
-  match(')');
-  match('{');
-  function_body();
-  
-  current_id = symbols;
-  while (current_id[Token]) {
-    if (current_id[Class] == Loc) {
-      current_id[Class] = current_id[BClass];
-      current_id[Type] = current_id[BType];
-      current_id[Value] = current_id[BValue];
+/**
+  * emit code leaving the value of expression `node` in ax.
+  */
+void gen_expression(int *node) {
+  int *addr, *id;
+  int kind, i;
+
+  text_reserve(64);
+  kind = node[0];
+  if (kind == Num) {
+    *++text = IMM;
+    *++text = node[2];
+  }
+  else if (kind == Loc || kind == Glo || kind == Deref || kind == Field) {
+    // load the value by its type
+    gen_address(node);
+    if (!is_struct(node[1])) {
+      *++text = (node[1] == CHAR) ? LC : LI;
     }
-    current_id = current_id + IdSize;
   }
-}
+  else if (kind == Addr) {
+    gen_address((int*)node[2]);
+  }
+  else if (kind == Func) {
+    // kept apart from IMM so that functions can be moved
+    *++text = IMMF;
+    *++text = (jobs || ((int*)node[2])[Size] < 0) ? node[2] : ((int*)node[2])[Value];
+  }
+  else if (kind == Fun || kind == Sys || kind == Ext) {
+    id = (int*)node[2];
+    if (kind == Fun && inlinable(id)) {
+      // expand small function in place
+      inline_call(id, node);
+      return;
+    }
 
-void enum_declaration() {
-  // parse enum [id] { a = 1, b = 2, ... }
-  int i = 0;
-  while (token != '}') {
-    if (token != Id) {
-      printf("%d: bad enum identifier %d\n", line, token);
-      exit(-1);
+    // pass in arguments
+    i = 0;
+    while (i < node[3]) {
+      gen_expression((int*)node[4 + i]);
+      *++text = PUSH;
+      i++;
     }
-    next();
 
-    if (token == Assign) {
-      // like {a = 10}
-      next();
-      if (token != Num) {
-        printf("%d: bad enum initializer\n", line);
+    if (kind == Sys) {
+      // system functions
+      *++text = node[2];
+    } else if (kind == Ext) {
+      // native function of a shared library, the operand is its symbol
+      *++text = NATV;
+      *++text = node[2];
+    } else {
+      // function call, with parallel code generation or a callee only
+      // declared so far the symbol is left for resolve_calls()
+      *++text = CALL;
+      *++text = (jobs || id[Size] < 0) ? (int)id : id[Value];
+    }
+
+    // clean the stack for arguments
+    if (node[3] > 0) {
+      *++text = ADJ;
+      *++text = node[3];
+    }
+  }
+  else if (kind == '!') {
+    // emit code use <expr> == 0
+    gen_expression((int*)node[2]);
+    *++text = PUSH;
+    *++text = IMM;
+    *++text = 0;
+    *++text = EQ;
+  }
+  else if (kind == '~') {
+    // emit code use <expr> XOR -1
+    gen_expression((int*)node[2]);
+    *++text = PUSH;
+    *++text = IMM;
+    *++text = -1;
+    *++text = XOR;
+  }
+  else if (kind == Neg) {
+    *++text = IMM;
+    *++text = (node[1] == DOUBLE) ? double_bits(-1.0) : -1;
+    *++text = PUSH;
+    gen_expression((int*)node[2]);
+    *++text = (node[1] == DOUBLE) ? FMUL : MUL;
+  }
+  else if (kind == Itof || kind == Ftoi) {
+    gen_expression((int*)node[2]);
+    *++text = (kind == Itof) ? ITOF : FTOI;
+  }
+  else if (kind == Inc || kind == Dec || kind == PostInc || kind == PostDec) {
+    // duplicate the address, load, add and store back
+    gen_address((int*)node[2]);
+    *++text = PUSH;
+    *++text = (node[1] == CHAR) ? LC : LI;
+    *++text = PUSH;
+    *++text = IMM;
+    *++text = (node[1] >= PTR) ? type_size(node[1] - PTR) : (node[1] == DOUBLE) ? double_bits(1.0) : sizeof(char);
+    *++text = (kind == Inc || kind == PostInc) ? ADD : SUB;
+    if (node[1] == DOUBLE) {
+      *text = *text - ADD + FADD;
+    }
+    *++text = (node[1] == CHAR) ? SC : SI;
+
+    if (kind == PostInc || kind == PostDec) {
+      // restore the original value in `ax`
+      *++text = PUSH;
+      *++text = IMM;
+      *++text = (node[1] >= PTR) ? type_size(node[1] - PTR) : (node[1] == DOUBLE) ? double_bits(1.0) : sizeof(char);
+      *++text = (kind == PostInc) ? SUB : ADD;
+      if (node[1] == DOUBLE) {
+        *text = *text - ADD + FADD;
+      }
+    }
+  }
+  else if (kind == Assign) {
+    // save the lvalue pointer
+    gen_address((int*)node[2]);
+    *++text = PUSH;
+    gen_expression((int*)node[3]);
+    *++text = (node[1] == CHAR) ? SC : SI;
+  }
+  else if (kind >= OrAssign && kind <= ModAssign) {
+    // duplicate the address as for ++, load, operate and store back
+    gen_address((int*)node[2]);
+    *++text = PUSH;
+    *++text = (node[1] == CHAR) ? LC : LI;
+    if (node[1] != DOUBLE && ((int*)node[3])[1] == DOUBLE) {
+      // int lvalue with double operand
+      *++text = ITOF;
+    }
+    *++text = PUSH;
+    gen_expression((int*)node[3]);
+    if (node[1] > PTR) {
+      // pointer movement, not char *
+      *++text = PUSH;
+      *++text = IMM;
+      *++text = type_size(node[1] - PTR);
+      *++text = MUL;
+    }
+    if (((int*)node[3])[1] == DOUBLE) {
+      *++text = compound_op(kind) - ADD + FADD;
+      if (node[1] != DOUBLE) {
+        *++text = FTOI;
+      }
+    } else {
+      *++text = compound_op(kind);
+    }
+    *++text = (node[1] == CHAR) ? SC : SI;
+  }
+  else if (kind == Cond) {
+    // <cond> JZ a <true> JMP b a: <false> b:
+    gen_expression((int*)node[2]);
+    *++text = JZ;
+    addr = ++text;
+    gen_expression((int*)node[3]);
+    *addr = (int)(text + 3);
+    *++text = JMP;
+    addr = ++text;
+    gen_expression((int*)node[4]);
+    *addr = (int)(text + 1);
+  }
+  else if (kind == Lor || kind == Lan) {
+    // short circuit
+    gen_expression((int*)node[2]);
+    *++text = (kind == Lor) ? JNZ : JZ;
+    addr = ++text;
+    gen_expression((int*)node[3]);
+    *addr = (int)(text + 1);
+  }
+  else if (kind == PtrAdd || kind == PtrSub) {
+    // scale the integer by the size of what the pointer points to
+    gen_expression((int*)node[2]);
+    *++text = PUSH;
+    gen_expression((int*)node[3]);
+    *++text = PUSH;
+    *++text = IMM;
+    *++text = type_size(node[1] - PTR);
+    *++text = MUL;
+    *++text = (kind == PtrAdd) ? ADD : SUB;
+  }
+  else if (kind == PtrDiff) {
+    gen_expression((int*)node[2]);
+    *++text = PUSH;
+    gen_expression((int*)node[3]);
+    *++text = SUB;
+    *++text = PUSH;
+    *++text = IMM;
+    *++text = type_size(node[1] - PTR);
+    *++text = DIV;
+  }
+  else if (kind >= Or && kind <= Mod) {
+    // binary operators share the order of their instructions
+    gen_expression((int*)node[2]);
+    *++text = PUSH;
+    gen_expression((int*)node[3]);
+    if (((int*)node[2])[1] == DOUBLE) {
+      // operands of double were both made double by the parser
+      *++text = (kind >= Eq && kind <= Ge) ? FEQ + (kind - Eq) : FADD + (kind - Add);
+    } else {
+      *++text = OR + (kind - Or);
+    }
+  }
+  else {
+    printf("compiler error, node = %d\n", kind);
+    exit(-1);
+  }
+  text_reserve(64);
+}
+
+/**
+  * emit code for statement `node` and the statements chained after it.
+  */
+void gen_statement(int *node) {
+  int *a, *b;
+
+  while (node) {
+    text_reserve(64);
+    if (node[0] != '{') {
+      lines[text + 1 - old_text] = node[2];
+    }
+
+    if (node[0] == If) {
+      //    if (<cond>)               <cond>
+      //                              JZ a
+      //      <true_statement>        <true_statement>
+      //    else                      JMP b
+      //  a:
+      //      <false_statement>       <false_statement>
+      //  b:
+      gen_expression((int*)node[3]);
+      *++text = JZ;
+      b = ++text;
+
+      gen_statement((int*)node[4]);
+      if (node[5]) {
+        // emit code for JMP b
+        *b = (int)(text + 3);
+        *++text = JMP;
+        b = ++text;
+
+        gen_statement((int*)node[5]);
+      }
+
+      *b = (int)(text + 1);
+    }
+    else if (node[0] == While) {
+      // a:
+      //    while (<cond>)              <cond>
+      //                                JZ b
+      //      <statement>               <statement>
+      //                                JMP a
+      // b:
+      a = text + 1;
+      gen_expression((int*)node[3]);
+      *++text = JZ;
+      b = ++text;
+
+      gen_statement((int*)node[4]);
+
+      *++text = JMP;
+      *++text = (int)a;
+      *b = (int)(text + 1);
+    }
+    else if (node[0] == Return) {
+      if (node[3]) {
+        gen_expression((int*)node[3]);
+      }
+
+      //  emit code for return
+      *++text = LEV;
+    }
+    else if (node[0] == '{') {
+      gen_statement((int*)node[3]);
+    }
+    else {
+      gen_expression((int*)node[3]);
+    }
+    text_reserve(64);
+    node = (int*)node[1];
+  }
+}
+
+/**
+  * emit a function with body `body` and `locals` slots of local variables.
+  */
+void gen_function(int *body, int locals) {
+  int *frame;                 // operand of ENT, patched when frame is known
+
+  // save the stack size for local variables, inlined calls may enlarge it
+  text_reserve(64);
+  *++text = ENT;
+  frame = ++text;
+  frame_top = frame_size = locals;
+
+  gen_statement(body);
+  *frame = frame_size;
+
+  // emit code for leaving the sub function
+  *++text = LEV;
+}
+
+/**
+  * parse the optional `[<size>]` of a declared variable of `type`, size
+  * is a number or enum constant. return the size of the array in bytes,
+  * 0 for a scalar and -1 for `[]`.
+  */
+int array_declaration(int type) {
+  int count;
+
+  if (token != Brak) {
+    return 0;
+  }
+  match(Brak);
+  if (token == ']') {
+    // size taken from the initializer of a global
+    match(']');
+    return -1;
+  }
+  count = 0;
+  if (token == Num) {
+    count = token_val;
+  } else if (token == Id && current_id[Class] == Num) {
+    count = current_id[Value];
+  }
+  if (count <= 0) {
+    printf("%d: bad array size\n", line);
+    exit(-1);
+  }
+  next();
+  match(']');
+
+  return count * complete_size(type);
+}
+
+/**
+  * size of `type` in bytes, a struct must have its members declared.
+  */
+int complete_size(int type) {
+  if (is_struct(type) && !type_size(type)) {
+    printf("%d: incomplete struct\n", line);
+    exit(-1);
+  }
+  return type_size(type);
+}
+
+/**
+  * parse `struct <tag>` with optional `{ <members> }` and return the type,
+  * a tag may be used behind pointers before its members are declared.
+  */
+int struct_declaration() {
+  int *record, *id, *member;
+  int index, base, type, bytes, offset, align, i;
+
+  match(Struct);
+  if (token != Id) {
+    printf("%d: bad struct name\n", line);
+    exit(-1);
+  }
+  index = 0;
+  while (index < struct_count && structs[index * StructSize + StructTag] != (int)current_id) {
+    index++;
+  }
+  if (index == struct_count) {
+    if (struct_count == PTR - STRUCT) {
+      printf("%d: too many structs\n", line);
+      exit(-1);
+    }
+    record = structs + struct_count++ * StructSize;
+    record[StructTag] = (int)current_id;
+    record[StructBytes] = 0;
+    record[StructAlign] = 1;
+  }
+  record = structs + index * StructSize;
+  match(Id);
+
+  if (token != '{') {
+    return STRUCT + index;
+  }
+  if (record[StructBytes]) {
+    printf("%d: duplicate struct declaration\n", line);
+    exit(-1);
+  }
+  match('{');
+
+  offset = 0;
+  align = 1;
+  while (token != '}') {
+    base = type_specifier();
+    while (token != ';') {
+      type = base;
+      while (token == Mul) {
+        match(Mul);
+        type = type + PTR;
+      }
+
+      if (token != Id) {
+        printf("%d: bad member declaration\n", line);
+        exit(-1);
+      }
+      id = current_id;
+      i = 0;
+      while (i < member_count) {
+        if (members[i * MemberSize + MemberStruct] == STRUCT + index && members[i * MemberSize + MemberId] == (int)id) {
+          printf("%d: duplicate member declaration\n", line);
+          exit(-1);
+        }
+        i++;
+      }
+      if ((member_count + 1) * MemberSize * sizeof(int) > poolsize) {
+        printf("%d: too many struct members\n", line);
+        exit(-1);
+      }
+      match(Id);
+      if ((bytes = array_declaration(type)) < 0) {
+        printf("%d: bad array size\n", line);
+        exit(-1);
+      }
+
+      // place the member at the next multiple of its alignment
+      offset = (offset + type_align(type) - 1) / type_align(type) * type_align(type);
+      if (type_align(type) > align) {
+        align = type_align(type);
+      }
+
+      member = members + member_count++ * MemberSize;
+      member[MemberStruct] = STRUCT + index;
+      member[MemberId] = (int)id;
+      member[MemberType] = bytes ? type + PTR : type;
+      member[MemberOffset] = offset;
+      member[MemberBytes] = bytes;
+      offset = offset + (bytes ? bytes : complete_size(type));
+
+      if (token == ',') {
+        match(',');
+      }
+    }
+    match(';');
+  }
+  match('}');
+
+  if (offset == 0) {
+    printf("%d: empty struct\n", line);
+    exit(-1);
+  }
+  record[StructBytes] = (offset + align - 1) / align * align;
+  record[StructAlign] = align;
+  return STRUCT + index;
+}
+
+/**
+  * parse the base type of a declaration: `int`, `char` or a struct,
+  * int when it is omitted.
+  */
+int type_specifier() {
+  if (token == Char) {
+    match(Char);
+    return CHAR;
+  }
+  if (token == Struct) {
+    return struct_declaration();
+  }
+  if (token == Double) {
+    if (sizeof(double) > sizeof(int)) {
+      printf("%d: double needs int of %d bytes\n", line, sizeof(double));
+      exit(-1);
+    }
+    match(Double);
+    return DOUBLE;
+  }
+  if (token == Int) {
+    match(Int);
+  }
+  return INT;
+}
+
+/**
+  * parse the parameters of function `id`, their number goes to
+  * id[Params] and a bit per double parameter to id[Doubles].
+  */
+void function_parameter(int *id) {
+  int type;
+  int params = 0;             // index of current parameter
+  int doubles = 0;            // bit i set if parameter i is double
+  while (token != ')') {
+    // int name, ...
+    type = type_specifier();
+
+    // pointer type
+    while (token == Mul) {
+      match(Mul);
+      type = type + PTR;
+    }
+    if (is_struct(type)) {
+      printf("%d: struct parameter must be a pointer\n", line);
+      exit(-1);
+    }
+    if (type == DOUBLE && params < 32) {
+      doubles = doubles | (1 << params);
+    }
+
+    // parameter name
+    if (token != Id) {
+      printf("%d: bad parameter declaration.\n", line);
+      exit(-1);
+    }
+    if (current_id[Class] == Loc) {
+      printf("%d: duplicate parameter declaration\n", line);
+      exit(-1);
+    }
+
+    match(Id);
+
+    // store the local variable
+    current_id[BClass] = current_id[Class];
+    current_id[Class] = Loc;
+    current_id[BType] = current_id[Type];
+    current_id[Type] = type;
+    current_id[BValue] = current_id[Value];
+    current_id[Value] = params++;
+    current_id[BSize] = current_id[Size];
+    current_id[Size] = 0;
+
+    if (token == ',') {
+      match(',');
+    }
+  }
+
+  index_of_bp = params + 1;
+  id[Params] = params;
+  id[Doubles] = doubles;
+}
+
+void function_body() {
+  // type func_name (...) {...}
+
+  // ... {
+  // 1. local declarations
+  // 2. statements
+  // }
+
+  int pos_local;              // position of local variables on the stack
+  int type, size;
+  int *id, *body, *last, *node;
+  pos_local = index_of_bp;
+
+  while (token == Int || token == Char || token == Struct || token == Double) {
+    // local variable declaration, just like global ones
+    base_type = type_specifier();
+
+    while (token != ';') {
+      type = base_type;
+      while (token == Mul) {
+        match(Mul);
+        type = type + PTR;
+      }
+
+      if (token != Id) {
+        // invalid declaration
+        printf("%d: bad local declaration\n", line);
         exit(-1);
       }
-      i = token_val;
-      next();
+      if (current_id[Class] == Loc) {
+        // identifier exists
+        printf("%d: duplicate local declaration\n", line);
+        exit(-1);
+      }
+      id = current_id;
+      match(Id);
+      if ((size = array_declaration(type)) < 0) {
+        printf("%d: bad array size\n", line);
+        exit(-1);
+      }
+      if (size) {
+        type = type + PTR;
+      } else if (is_struct(type)) {
+        size = complete_size(type);
+      }
+
+      // store the local variable, an array or struct takes as many slots
+      // as it needs and is addressed by its lowest one
+      id[BClass] = id[Class];
+      id[Class] = Loc;
+      id[BType] = id[Type];
+      id[Type] = type;
+      id[BValue] = id[Value];
+      id[BSize] = id[Size];
+      id[Size] = size;
+      if (size) {
+        pos_local = pos_local + (size + sizeof(int) - 1) / sizeof(int);
+        id[Value] = pos_local;
+      } else {
+        id[Value] = ++pos_local;
+      }
+
+      if (token == ',') {
+        match(',');
+      }
+    }
+    match(';');
+  }
+
+  // statements, chained under a block node like in statement()
+  body = statement_node('{', 1);
+  last = body + 3;
+  while (token != '}') {
+    if ((node = statement())) {
+      *last = (int)node;
+      last = node + 1;
+    }
+  }
+
+  if (jobs) {
+    // generated later on a worker thread, keep the syntax tree
+    gen_jobs[gen_count * GenSize + GenBody] = (int)body;
+    gen_jobs[gen_count * GenSize + GenFrame] = pos_local - index_of_bp;
+    return;
+  }
+  gen_function(body, pos_local - index_of_bp);
+
+  // drop the syntax tree of the function
+  ast = old_ast;
+}
+
+/**
+  * skip the body of a function up to its matching '}' without lexing
+  * it, strings, characters, comments and macros are skipped like in
+  * scan(). the current token is '{' and becomes '}'.
+  */
+void skip_body() {
+  int depth;
+  char *p, q;
+
+  depth = 1;
+  p = src;
+  while (depth > 0 && *p) {
+    if (*p == '\n') {
+      line++;
+    } else if (*p == '{') {
+      depth++;
+    } else if (*p == '}') {
+      depth--;
+    } else if (*p == '"' || *p == '\'') {
+      q = *p++;
+      while (*p && *p != q) {
+        if (*p++ == '\\' && *p) {
+          p++;
+        }
+      }
+    } else if ((*p == '/' && p[1] == '/') || *p == '#') {
+      while (p[1] && p[1] != '\n') {
+        p++;
+      }
+    }
+    if (*p) {
+      p++;
+    }
+  }
+  if (depth > 0) {
+    printf("%d: unexpected end of file in function body\n", line);
+    exit(-1);
+  }
+  src = p;
+  token = '}';
+}
+
+void function_declaration(int *id) {
+  // type func_name (...) {...}
+  match('(');
+  function_parameter(id);
+  match(')');
+  if (token != ';') {
+    if (lazy) {
+      // compiled by lazy_compile() on the first call
+      skip_body();
+    } else {
+      match('{');
+      function_body();
+    }
+  }
+  
+  current_id = symbols;
+  while (current_id[Token]) {
+    if (current_id[Class] == Loc) {
+      current_id[Class] = current_id[BClass];
+      current_id[Type] = current_id[BType];
+      current_id[Value] = current_id[BValue];
+      current_id[Size] = current_id[BSize];
+    }
+    current_id = current_id + IdSize;
+  }
+}
+
+void enum_declaration() {
+  // parse enum [id] { a = 1, b = 2, ... }
+  int i = 0;
+  while (token != '}') {
+    if (token != Id) {
+      printf("%d: bad enum identifier %d\n", line, token);
+      exit(-1);
+    }
+    next();
+
+    if (token == Assign) {
+      // like {a = 10}
+      next();
+      if (token != Num) {
+        printf("%d: bad enum initializer\n", line);
+        exit(-1);
+      }
+      i = token_val;
+      next();
+    }
+
+    current_id[Class] = Num;
+    current_id[Type] = INT;
+    current_id[Value] = i++;
+
+    if (token == ',') {
+      next();
+    }
+
+  }
+}
+
+/**
+  * resolve function `id` declared without body and never defined in the
+  * libraries loaded with -l and the program itself, its value is the
+  * line of the declaration.
+  */
+void native_declaration(int *id) {
+  char name[256];
+  int line;
+
+  line = id[Value];
+  if (id[Params] > 6) {
+    printf("%d: native function with more than 6 parameters\n", line);
+    exit(-1);
+  }
+  sprintf(name, "%.*s", name_length(id) < 255 ? name_length(id) : 255, (char*)id[Name]);
+  if (!(id[Value] = (int)dlsym(RTLD_DEFAULT, name))) {
+    printf("%d: undefined native function %s\n", line, name);
+    exit(-1);
+  }
+  id[Class] = Ext;
+  id[Size] = 0;
+}
+
+/**
+  * value of the constant expression `node`, for the initializers of
+  * globals. strings, sizeof and enum constants are numbers already.
+  */
+int constant_value(int *node) {
+  int kind, a, b;
+  double x, y;
+
+  kind = node[0];
+  if (kind == Num) {
+    return node[2];
+  }
+  if (kind == Addr && ((int*)node[2])[0] == Glo) {
+    return ((int*)node[2])[2];
+  }
+  if (kind == Itof) {
+    return double_bits((double)constant_value((int*)node[2]));
+  }
+  if (kind == Ftoi) {
+    return (int)bits_double(constant_value((int*)node[2]));
+  }
+  if (kind == Neg) {
+    a = constant_value((int*)node[2]);
+    return (node[1] == DOUBLE) ? double_bits(-bits_double(a)) : -a;
+  }
+  if (kind == '!') {
+    return !constant_value((int*)node[2]);
+  }
+  if (kind == '~') {
+    return ~constant_value((int*)node[2]);
+  }
+  if (kind < Or || kind > Mod) {
+    printf("%d: initializer is not constant\n", line);
+    exit(-1);
+  }
+
+  a = constant_value((int*)node[2]);
+  b = constant_value((int*)node[3]);
+  if (((int*)node[2])[1] == DOUBLE) {
+    // both sides were made double by the parser
+    x = bits_double(a);
+    y = bits_double(b);
+    if (kind == Eq)  return x == y;
+    if (kind == Ne)  return x != y;
+    if (kind == Lt)  return x < y;
+    if (kind == Gt)  return x > y;
+    if (kind == Le)  return x <= y;
+    if (kind == Ge)  return x >= y;
+    if (kind == Add) return double_bits(x + y);
+    if (kind == Sub) return double_bits(x - y);
+    if (kind == Mul) return double_bits(x * y);
+    return double_bits(x / y);
+  }
+  if ((kind == Div || kind == Mod) && b == 0) {
+    printf("%d: division by zero in initializer\n", line);
+    exit(-1);
+  }
+  if (kind == Or)  return a | b;
+  if (kind == Xor) return a ^ b;
+  if (kind == And) return a & b;
+  if (kind == Eq)  return a == b;
+  if (kind == Ne)  return a != b;
+  if (kind == Lt)  return a < b;
+  if (kind == Gt)  return a > b;
+  if (kind == Le)  return a <= b;
+  if (kind == Ge)  return a >= b;
+  if (kind == Shl) return a << b;
+  if (kind == Shr) return a >> b;
+  if (kind == Add) return a + b;
+  if (kind == Sub) return a - b;
+  if (kind == Mul) return a * b;
+  if (kind == Div) return a / b;
+  return a % b;
+}
+
+/**
+  * parse a constant expression and convert it to `type`.
+  */
+int convert_constant(int type) {
+  int *node;
+
+  node = expression(Assign);
+  return constant_value(convert(node, expr_type, type));
+}
+
+/**
+  * parse the initializer of global `id` whose elements are of `type` and
+  * give it its place in `data`. the values are computed first since
+  * strings in them are stored in `data` too, then the variable goes
+  * after them, an array with `[]` gets the size of its initializer.
+  */
+void global_initializer(int *id, int type) {
+  int *values, *node;
+  int count, size, i;
+
+  if (is_struct(type)) {
+    printf("%d: struct initializer not supported\n", line);
+    exit(-1);
+  }
+
+  if (id[Size] && type == CHAR && token == '"') {
+    // char array of a string, which is stored in place already
+    node = expression(Assign);
+    id[Value] = node[2];
+    size = strlen((char*)id[Value]) + 1;
+    if (id[Size] < 0) {
+      id[Size] = size;
+    } else if (size - 1 > id[Size]) {
+      printf("%d: string longer than array\n", line);
+      exit(-1);
+    }
+    data = (char*)id[Value];
+    return;
+  }
+
+  values = malloc(poolsize);
+  count = 0;
+  if (!id[Size]) {
+    values[count++] = convert_constant(type);
+  } else {
+    match('{');
+    while (token != '}') {
+      if (count == poolsize / sizeof(int)) {
+        printf("%d: too many initializers\n", line);
+        exit(-1);
+      }
+      values[count++] = convert_constant(type);
+      if (token == ',') {
+        match(',');
+      }
+    }
+    match('}');
+
+    size = count * complete_size(type);
+    if (id[Size] < 0) {
+      id[Size] = size;
+    } else if (size > id[Size]) {
+      printf("%d: too many initializers\n", line);
+      exit(-1);
+    }
+  }
+
+  // after the strings, aligned to int
+  data = (char*)(((int)data + sizeof(int) - 1) & (-sizeof(int)));
+  id[Value] = (int)data;
+  i = 0;
+  while (i < count) {
+    if (type == CHAR) {
+      data[i] = values[i];
+    } else {
+      ((int*)data)[i] = values[i];
+    }
+    i++;
+  }
+  free(values);
+}
+
+void global_declaration() {
+  // global_declaration ::= enum_decl | variable_decl | function_decl
+  // enum_decl ::= 'enum' [id] '{' id ['=' 'num'] {',' id ['=' 'num'} '}'
+  // variable_decl ::= type {'*'} id ['[' [size] ']'] ['=' init] { ',' {'*'} id ['[' [size] ']'] ['=' init] } ';'
+  // init ::= const_expr | '{' const_expr {',' const_expr} [','] '}' | string
+  // type ::= 'int' | 'char' | 'struct' id ['{' {type {'*'} id ['[' size ']'] ';'} '}']
+  // function_decl ::= type {'*'} id '(' parameter_decl ')' ('{' body_decl '}' | ';')
+
+  int type;           // type for variable
+  int *id;
+
+  // parse enum, this should be treated alone
+  if (token == Enum) {
+    // enum [id] {a = 10, b= 20, ... }
+    match(Enum);
+    if (token != '{') {
+      // skip the [id] part
+      match(Id);
+    }
+    if (token == '{') {
+      // parse the assign part
+      match('{');
+      enum_declaration();
+      match('}');
+    }
+
+    match(';');
+    return;
+  }
+
+  // parse type information, a struct may declare its members here
+  base_type = type_specifier();
+
+  // parse the comma seperated variable declaration
+  while (token != ';' && token != '}') {
+    type = base_type;
+    // parse pointer type, note that there may exist `int ****x;`
+    while (token == Mul) {
+      match(Mul);
+      type = type + PTR;
+    }
+
+    if (token != Id) {
+      // invalid declaration
+      printf("%d: bad global declaration\n", line);
+      exit(-1);
+    }
+
+    if (current_id[Class] && !(current_id[Class] == Fun && current_id[Size] < 0)) {
+      // identifier exists, other than a function declared without body
+      printf("%d: duplicate global declaration\n", line);
+      exit(-1);
+    }
+    match(Id);
+    if (current_id[Class] && token != '(') {
+      printf("%d: duplicate global declaration\n", line);
+      exit(-1);
+    }
+    current_id[Type] = type;
+
+    if (token == '(') {
+      if (is_struct(type)) {
+        printf("%d: struct return value must be a pointer\n", line);
+        exit(-1);
+      }
+      id = current_id;
+      id[Class] = Fun;
+      return_type = type;
+      if (lazy) {
+        // a stub calls lazy_compile() until the body is compiled
+        lazy_jobs[lazy_count * LazySize + LazyId] = (int)id;
+        lazy_jobs[lazy_count * LazySize + LazySrc] = (int)src;
+        lazy_jobs[lazy_count * LazySize + LazyLine] = line;
+        id[Value] = (int)(text + 1);
+        function_declaration(id);
+        if (token != ';') {
+          text_reserve(2);
+          *++text = LAZY;
+          *++text = (int)(lazy_jobs + lazy_count++ * LazySize);
+        }
+        id[Size] = text + 1 - (int*)id[Value];
+      } else if (jobs) {
+        // placed by gen_all() once its code is generated
+        id[Size] = 0;
+        gen_jobs[gen_count * GenSize + GenId] = (int)id;
+        gen_jobs[gen_count * GenSize + GenLine] = line;
+        function_declaration(id);
+        if (token != ';') {
+          gen_count++;
+        }
+      } else {
+        id[Value] = (int)(text + 1);          // the memory address of function
+        lines[text + 1 - old_text] = line;
+        function_declaration(id);
+        id[Size] = text + 1 - (int*)id[Value];
+      }
+      if (token == ';') {
+        // declared without body, defined later or else looked up in the
+        // libraries loaded by -l at the end of program(), meanwhile the
+        // value is the line of the declaration
+        id[Value] = line;
+        id[Size] = -1;
+      }
+    } else {
+      id = current_id;
+      id[Class] = Glo;
+      id[Size] = array_declaration(type);
+      if (id[Size]) {
+        id[Type] = type + PTR;
+      } else if (is_struct(type)) {
+        id[Size] = complete_size(type);
+      }
+      if (token == Assign) {
+        // evaluated now and placed with its value
+        match(Assign);
+        global_initializer(id, type);
+      } else if (id[Size] < 0) {
+        printf("%d: array size missing\n", line);
+        exit(-1);
+      } else {
+        id[Value] = (int)data;                // assign memory address
+      }
+      if (id[Size]) {
+        // array or struct, keep data aligned to int
+        data = data + (id[Size] + sizeof(int) - 1) / sizeof(int) * sizeof(int);
+      } else {
+        data = data + sizeof(int);
+      }
+    }
+
+    if (token == ',') {
+      match(',');
+    }
+  }
+
+  next();
+}
+
+/******************************************************************
+parallel code generation: with `-jobs n` the parser keeps the syntax
+tree of every function in `gen_jobs` instead of generating its code
+right away. after the whole source is parsed n threads take the
+functions one by one and generate each into a private buffer, `text`
+and `lines` are per thread. gen_all() then copies the functions into
+`text` in source order, moves their jump targets along and turns the
+symbols left as operands of CALL and IMMF into addresses. inlining
+needs the code of the callee and is not done in this mode.
+*******************************************************************/
+int gen_next;                 // next function to be taken by a thread
+pthread_mutex_t gen_lock;
+
+int line_at(int *addr);
+
+/**
+  * turn the symbols left as operands of CALL and IMMF in the code from
+  * `code` to `end` into addresses, calls of native functions into NATV.
+  */
+void resolve_calls(int *code, int *end) {
+  int *id;
+
+  while (code < end) {
+    if ((*code == CALL || *code == IMMF) && (int*)code[1] >= symbols && (int*)code[1] < symbol_end) {
+      id = (int*)code[1];
+      if (id[Class] != Ext) {
+        code[1] = id[Value];
+      } else if (*code == IMMF) {
+        printf("%d: native function has no address\n", line_at(code));
+        exit(-1);
+      } else if (((code[2] == ADJ) ? code[3] : 0) != id[Params]) {
+        // arguments are taken from the stack by the declared number
+        printf("%d: native function takes %d arguments\n", line_at(code), id[Params]);
+        exit(-1);
+      } else {
+        *code = NATV;
+      }
+    }
+    code = code + ((*code <= ADJ) ? 2 : 1);
+  }
+}
+
+/**
+  * code generating thread, take functions until none is left.
+  */
+void *gen_worker(void *arg) {
+  int *job;
+  int i;
+
+  if (!(old_text = malloc(poolsize)) || !(lines = malloc(poolsize))) {
+    printf("could not malloc (%d) for code generation\n", poolsize);
+    exit(-1);
+  }
+  memset(lines, 0, poolsize);
+
+  while (1) {
+    pthread_mutex_lock(&gen_lock);
+    i = gen_next++;
+    pthread_mutex_unlock(&gen_lock);
+    if (i >= gen_count) {
+      break;
+    }
+
+    job = gen_jobs + i * GenSize;
+    text = old_text;
+    lines[1] = job[GenLine];
+    gen_function((int*)job[GenBody], job[GenFrame]);
+
+    // keep the code, clear the line table for the next function
+    job[GenWords] = text - old_text;
+    job[GenBase] = (int)(old_text + 1);
+    job[GenCode] = (int)malloc(job[GenWords] * sizeof(int));
+    job[GenLines] = (int)malloc(job[GenWords] * sizeof(int));
+    memcpy((int*)job[GenCode], old_text + 1, job[GenWords] * sizeof(int));
+    memcpy((int*)job[GenLines], lines + 1, job[GenWords] * sizeof(int));
+    memset(lines + 1, 0, job[GenWords] * sizeof(int));
+  }
+
+  free(old_text);
+  free(lines);
+  return 0;
+}
+
+/**
+  * generate the code of all parsed functions on `jobs` threads and place
+  * it after the end of `text`.
+  */
+void gen_all() {
+  pthread_t *threads;
+  int *job, *code, *end;
+  int i;
+
+  threads = malloc(jobs * sizeof(pthread_t));
+  pthread_mutex_init(&gen_lock, 0);
+  gen_next = 0;
+  i = 0;
+  while (i < jobs) {
+    if (pthread_create(threads + i, 0, gen_worker, 0)) {
+      printf("could not start code generation thread\n");
+      exit(-1);
+    }
+    i++;
+  }
+  i = 0;
+  while (i < jobs) {
+    pthread_join(threads[i++], 0);
+  }
+  free(threads);
+
+  // place in source order and relocate jumps
+  i = 0;
+  while (i < gen_count) {
+    job = gen_jobs + i * GenSize;
+    text_reserve(job[GenWords]);
+    code = text + 1;
+    memcpy(code, (int*)job[GenCode], job[GenWords] * sizeof(int));
+    memcpy(lines + (code - old_text), (int*)job[GenLines], job[GenWords] * sizeof(int));
+    free((int*)job[GenCode]);
+    free((int*)job[GenLines]);
+    ((int*)job[GenId])[Value] = (int)code;
+    ((int*)job[GenId])[Size] = job[GenWords];
+    text = text + job[GenWords];
+
+    end = text + 1;
+    while (code < end) {
+      if (*code == JMP || *code == JZ || *code == JNZ) {
+        code[1] = (int)((int*)code[1] - (int*)job[GenBase] + (int*)((int*)job[GenId])[Value]);
+      }
+      code = code + ((*code <= ADJ) ? 2 : 1);
+    }
+    i++;
+  }
+
+  // every function has its address now
+  i = 0;
+  while (i < gen_count) {
+    code = (int*)((int*)gen_jobs[i * GenSize + GenId])[Value];
+    resolve_calls(code, code + gen_jobs[i * GenSize + GenWords]);
+    i++;
+  }
+
+  // drop the syntax trees
+  ast = old_ast;
+}
+
+/**
+  * entry of grammar parse.
+  */
+void program() {
+  struct timeval start, end;
+  int *id;
+
+  if (lex_threads) {
+    gettimeofday(&start, 0);
+    lex_count = lex_all();
+    gettimeofday(&end, 0);
+    lex_time = (end.tv_sec - start.tv_sec) * 1000000 + end.tv_usec - start.tv_usec;
+  }
+  next();
+  while (token > 0) {
+    global_declaration();
+  }
+
+  // functions declared but never defined come from the libraries
+  id = symbols;
+  while (id[Token]) {
+    if (id[Class] == Fun && id[Size] < 0) {
+      native_declaration(id);
+    }
+    id = id + IdSize;
+  }
+
+  if (jobs) {
+    gen_all();
+  } else {
+    resolve_calls(old_text + 1, text + 1);
+  }
+  return;
+}
+
+/**
+  * dead function elimination: walk the call graph from main along CALL
+  * targets, drop functions that can't be reached, move the rest down to
+  * close the gaps and relocate CALL and jump targets.
+  * return the number of words removed from text segment.
+  */
+int eliminate_functions() {
+  int **funcs, *live, *work, *start, *code, *end;
+  int count, i, j, top, saved;
+
+  // collect functions ordered by address
+  count = 0;
+  current_id = symbols;
+  while (current_id[Token]) {
+    if (current_id[Class] == Fun) {
+      count++;
+    }
+    current_id = current_id + IdSize;
+  }
+  if (count == 0) {
+    return 0;
+  }
+
+  funcs = malloc(count * sizeof(int *));
+  live = malloc(count * sizeof(int));
+  work = malloc(count * sizeof(int));
+  count = 0;
+  current_id = symbols;
+  while (current_id[Token]) {
+    if (current_id[Class] == Fun) {
+      i = count++;
+      while (i > 0 && funcs[i - 1][Value] > current_id[Value]) {
+        funcs[i] = funcs[i - 1];
+        i--;
+      }
+      funcs[i] = current_id;
+    }
+    current_id = current_id + IdSize;
+  }
+
+  // mark functions reachable from main, by call or by address
+  memset(live, 0, count * sizeof(int));
+  top = 0;
+  i = 0;
+  while (i < count && funcs[i] != idmain) {
+    i++;
+  }
+  if (i == count) {
+    free(funcs); free(live); free(work);
+    return 0;
+  }
+  live[i] = 1;
+  work[top++] = i;
+  while (top > 0) {
+    i = work[--top];
+    code = (int*)funcs[i][Value];
+    end = code + funcs[i][Size];
+    while (code < end) {
+      if (*code == CALL || *code == IMMF) {
+        j = 0;
+        while (j < count && funcs[j][Value] != code[1]) {
+          j++;
+        }
+        if (j < count && !live[j]) {
+          live[j] = 1;
+          work[top++] = j;
+        }
+      }
+      code = code + ((*code <= ADJ) ? 2 : 1);
+    }
+  }
+
+  // new address of every live function, reuse `work` to keep them
+  start = (int*)funcs[0][Value];
+  i = 0;
+  while (i < count) {
+    work[i] = (int)start;
+    if (live[i]) {
+      start = start + funcs[i][Size];
+    }
+    i++;
+  }
+
+  // relocate in place, then move down, in address order so nothing is
+  // overwritten before it is moved
+  saved = text + 1 - start;
+  i = 0;
+  while (i < count) {
+    if (live[i]) {
+      code = (int*)funcs[i][Value];
+      end = code + funcs[i][Size];
+      while (code < end) {
+        if (*code == CALL || *code == IMMF) {
+          j = 0;
+          while (funcs[j][Value] != code[1]) {
+            j++;
+          }
+          code[1] = work[j];
+        } else if (*code == JMP || *code == JZ || *code == JNZ) {
+          code[1] = code[1] - funcs[i][Value] + work[i];
+        }
+        code = code + ((*code <= ADJ) ? 2 : 1);
+      }
+    }
+    i++;
+  }
+
+  i = 0;
+  while (i < count) {
+    if (live[i]) {
+      memmove((int*)work[i], (int*)funcs[i][Value], funcs[i][Size] * sizeof(int));
+      memmove(lines + ((int*)work[i] - old_text), lines + ((int*)funcs[i][Value] - old_text), funcs[i][Size] * sizeof(int));
+      funcs[i][Value] = work[i];
+    } else {
+      funcs[i][Value] = 0;
+      funcs[i][Size] = 0;
+    }
+    i++;
+  }
+
+  memset(start, 0, saved * sizeof(int));
+  memset(lines + (start - old_text), 0, saved * sizeof(int));
+  text = start - 1;
+
+  free(funcs);
+  free(live);
+  free(work);
+  return saved;
+}
+
+/**
+  * function whose code contains address `addr`, 0 if none.
+  */
+int *function_at(int *addr) {
+  int *id;
+
+  id = symbols;
+  while (id[Token]) {
+    if (id[Class] == Fun && (int*)id[Value] <= addr && addr < (int*)id[Value] + id[Size]) {
+      return id;
+    }
+    id = id + IdSize;
+  }
+  return 0;
+}
+
+/**
+  * source line of the statement that emitted the code at `addr`, 0 if
+  * it is not known.
+  */
+int line_at(int *addr) {
+  int *id;
+
+  if (!(id = function_at(addr))) {
+    return 0;
+  }
+  while (addr >= (int*)id[Value]) {
+    if (lines[addr - old_text]) {
+      return lines[addr - old_text];
+    }
+    addr--;
+  }
+  return 0;
+}
+
+/**
+  * print source line `n` without the newline.
+  */
+void print_source_line(int n) {
+  char *start, *end;
+
+  start = old_src;
+  while (--n > 0 && *start) {
+    while (*start && *start != '\n') {
+      start++;
+    }
+    if (*start) {
+      start++;
+    }
+  }
+  end = start;
+  while (*end && *end != '\n') {
+    end++;
+  }
+  printf("%.*s", end - start, start);
+}
+
+/**
+  * dump the text segment with names of instructions, CALL targets and the
+  * source lines, then the static statistics: size of every function, the
+  * histogram of instructions and the PUSHes consumed by a stack operation.
+  */
+void disassemble() {
+  int *code, *end, *id, *counts;
+  int op, i, max, total, instructions, pushes, pairs, depth, last_line;
+
+  counts = malloc((EXIT + 1) * sizeof(int));
+  memset(counts, 0, (EXIT + 1) * sizeof(int));
+  total = 0;
+  last_line = 0;
+
+  code = old_text + 1;
+  while (code <= text) {
+    if ((id = function_at(code)) && (int*)id[Value] == code) {
+      printf("\n%.*s:\n", name_length(id), (char*)id[Name]);
+    }
+    if (lines[code - old_text] && lines[code - old_text] != last_line) {
+      last_line = lines[code - old_text];
+      printf("%5d: ", last_line);
+      print_source_line(last_line);
+      printf("\n");
+    }
+
+    op = *code;
+    if (op < LEA || op > EXIT) {
+      printf("  %04d  ?? %d\n", code - old_text, op);
+      code++;
+      continue;
+    }
+    counts[op]++;
+    total++;
+    printf("  %04d  %.4s", code - old_text, op_names + op * 5);
+    if (op == CALL || op == IMMF) {
+      id = function_at((int*)code[1]);
+      if (id) {
+        printf("  %.*s\n", name_length(id), (char*)id[Name]);
+      } else {
+        printf("  %04d\n", (int*)code[1] - old_text);
+      }
+    } else if (op == NATV) {
+      printf("  %.*s\n", name_length((int*)code[1]), (char*)((int*)code[1])[Name]);
+    } else if (op == JMP || op == JZ || op == JNZ) {
+      printf("  %04d\n", (int*)code[1] - old_text);
+    } else if (op <= ADJ) {
+      printf("  %d\n", code[1]);
+    } else {
+      printf("\n");
+    }
+    code = code + ((op <= ADJ) ? 2 : 1);
+  }
+
+  // size of every function, PUSH paired with the operation popping it
+  printf("\n%-16s %8s %8s %8s %8s\n", "function", "bytes", "instrs", "pushes", "pairs");
+  code = old_text + 1;
+  while (code <= text) {
+    id = function_at(code);
+    end = id ? (int*)id[Value] + id[Size] : text + 1;
+    instructions = pushes = pairs = depth = 0;
+    while (code < end) {
+      op = *code;
+      instructions++;
+      if (op == PUSH) {
+        pushes++;
+        depth++;
+      } else if ((op >= OR && op <= MOD) || (op >= FADD && op <= FGE) || op == SI || op == SC) {
+        if (depth > 0) {
+          pairs++;
+          depth--;
+        }
+      } else if (op == ADJ) {
+        depth = (depth > code[1]) ? depth - code[1] : 0;
+      }
+      code = code + ((op <= ADJ) ? 2 : 1);
+    }
+    if (id) {
+      printf("%-16.*s %8d %8d %8d %8d\n", name_length(id), (char*)id[Name],
+             id[Size] * sizeof(int), instructions, pushes, pairs);
+    }
+  }
+
+  // instructions by frequency
+  printf("\n%-8s %8s %8s\n", "instr", "count", "percent");
+  while (1) {
+    max = -1;
+    i = LEA;
+    while (i <= EXIT) {
+      if (counts[i] && (max < 0 || counts[i] > counts[max])) {
+        max = i;
+      }
+      i++;
+    }
+    if (max < 0) {
+      break;
+    }
+    printf("%-8.4s %8d %7d%%\n", op_names + max * 5, counts[max], counts[max] * 100 / total);
+    counts[max] = 0;
+  }
+  printf("total %d instructions, %d bytes\n", total, (text - old_text) * sizeof(int));
+  free(counts);
+}
+
+/**
+  * evaluate binary instruction `op` on constants.
+  */
+int fold(int op, int a, int b) {
+  if (op == OR)  return a | b;
+  if (op == XOR) return a ^ b;
+  if (op == AND) return a & b;
+  if (op == EQ)  return a == b;
+  if (op == NE)  return a != b;
+  if (op == LT)  return a < b;
+  if (op == GT)  return a > b;
+  if (op == LE)  return a <= b;
+  if (op == GE)  return a >= b;
+  if (op == SHL) return a << b;
+  if (op == SHR) return a >> b;
+  if (op == ADD) return a + b;
+  if (op == SUB) return a - b;
+  if (op == MUL) return a * b;
+  if (op == DIV) return a / b;
+  return a % b;
+}
+
+/**
+  * peephole optimizer for the hot tier, rewrite `size` words of function
+  * `code` into `out` and return the words written:
+  * 1. thread jumps to JMP through to their final target
+  * 2. fold `IMM a; PUSH; IMM b; <op>` into `IMM a <op> b`, repeatedly
+  * 3. drop JMP to the next instruction and code that can't be reached
+  */
+int optimize(int *code, int size, int *out) {
+  int *target, *dest, *map;
+  int i, n, op, t, last, dead, steps;
+
+  target = malloc((size + 1) * sizeof(int));
+  dest = malloc((size + 1) * sizeof(int));
+  map = malloc((size + 1) * sizeof(int));
+  memset(target, 0, (size + 1) * sizeof(int));
+
+  // thread jumps and mark the final targets, `code` may be running so
+  // it is left untouched
+  i = 0;
+  while (i < size) {
+    op = code[i];
+    if (op == JMP || op == JZ || op == JNZ) {
+      t = (int*)code[i + 1] - code;
+      steps = 0;
+      while (t < size && code[t] == JMP && steps++ < size) {
+        t = (int*)code[t + 1] - code;
+      }
+      dest[i] = t;
+      target[t] = 1;
+    }
+    i = i + ((op <= ADJ) ? 2 : 1);
+  }
+
+  n = 0;
+  last = -1;                  // index in `out` of the last instruction
+  dead = 0;
+  i = 0;
+  while (i < size) {
+    op = code[i];
+    if (target[i]) {
+      dead = 0;
+    }
+    map[i] = n;
+
+    if (dead) {
+      i = i + ((op <= ADJ) ? 2 : 1);
+    }
+    else if (op == PUSH && last >= 0 && out[last] == IMM && !target[i]
+             && i + 3 < size && code[i + 1] == IMM && !target[i + 1]
+             && code[i + 3] >= OR && code[i + 3] <= MOD && !target[i + 3]
+             && !((code[i + 3] == DIV || code[i + 3] == MOD) && code[i + 2] == 0)) {
+      // constant operands, keep the result in the last IMM
+      out[last + 1] = fold(code[i + 3], out[last + 1], code[i + 2]);
+      map[i + 1] = map[i + 3] = n;
+      i = i + 4;
+    }
+    else if (op == JMP && dest[i] == i + 2) {
+      i = i + 2;
+    }
+    else {
+      if (op == JMP || op == LEV) {
+        dead = 1;
+      }
+      last = n;
+      out[n++] = code[i++];
+      if (op <= ADJ) {
+        // jumps keep the old target until relocated below
+        out[n++] = (op == JMP || op == JZ || op == JNZ) ? dest[i - 1] : code[i];
+        i++;
+      }
+    }
+  }
+  map[size] = n;
+
+  // relocate jumps into the new code
+  i = 0;
+  while (i < n) {
+    if (out[i] == JMP || out[i] == JZ || out[i] == JNZ) {
+      out[i + 1] = (int)(out + map[out[i + 1]]);
+    }
+    i = i + ((out[i] <= ADJ) ? 2 : 1);
+  }
+
+  free(target);
+  free(dest);
+  free(map);
+  return n;
+}
+
+/******************************************************************
+tiered execution: `eval()` counts calls at the entry of the callee and
+back-edges at every backward JMP, counters are kept in `tier_counts`
+parallel to `text`. A function whose calls or any of whose loops cross
+`tier_threshold` is queued, a worker thread optimizes a copy of its code
+into the area after `text`, and the next CALL installs it by replacing
+`ENT n` at the entry with `JMP <optimized>`.
+*******************************************************************/
+int tier_threshold;           // promote hot functions after so many hits, 0 to disable
+int *tier_counts;             // hit counters, indexed like `text`
+int *tier_text, *tier_end;    // free area for optimized code
+int *tier_jobs;               // promotion events
+int tier_count;               // number of promotion events
+volatile int tier_ready;      // optimized code waiting to be installed
+pthread_mutex_t tier_lock;
+pthread_cond_t tier_wake;
+
+// fields of promotion event
+enum {TierId, TierState, TierCode, TierOldSize, TierNewSize, TierQueued, TierInstalled, TierSize};
+
+// states of promotion event
+enum {Queued = 1, Ready, Installed, Failed};
+
+/**
+  * background compiler, optimize queued functions one by one.
+  */
+void *tier_worker(void *arg) {
+  int *job, *id;
+  int i, n;
+
+  while (1) {
+    pthread_mutex_lock(&tier_lock);
+    job = 0;
+    while (!job) {
+      i = 0;
+      while (i < tier_count && tier_jobs[i * TierSize + TierState] != Queued) {
+        i++;
+      }
+      if (i < tier_count) {
+        job = tier_jobs + i * TierSize;
+      } else {
+        pthread_cond_wait(&tier_wake, &tier_lock);
+      }
+    }
+    pthread_mutex_unlock(&tier_lock);
+
+    id = (int*)job[TierId];
+    n = 0;
+    if (tier_text + id[Size] <= tier_end) {
+      n = optimize((int*)id[Value], id[Size], tier_text);
+    }
+
+    pthread_mutex_lock(&tier_lock);
+    if (n) {
+      job[TierCode] = (int)tier_text;
+      job[TierNewSize] = n;
+      job[TierState] = Ready;
+      tier_text = tier_text + n;
+      tier_ready++;
+    } else {
+      job[TierState] = Failed;
+    }
+    pthread_mutex_unlock(&tier_lock);
+  }
+  return 0;
+}
+
+/**
+  * queue the function containing `addr` for the optimized tier.
+  */
+void tier_promote(int *addr) {
+  int *id, *job;
+  int i;
+
+  if (!(id = function_at(addr))) {
+    // already optimized code
+    return;
+  }
+
+  pthread_mutex_lock(&tier_lock);
+  i = 0;
+  while (i < tier_count && tier_jobs[i * TierSize + TierId] != (int)id) {
+    i++;
+  }
+  if (i == tier_count) {
+    job = tier_jobs + tier_count++ * TierSize;
+    job[TierId] = (int)id;
+    job[TierState] = Queued;
+    job[TierOldSize] = id[Size];
+    job[TierQueued] = tier_counts[(int*)id[Value] - old_text];
+    pthread_cond_signal(&tier_wake);
+  }
+  pthread_mutex_unlock(&tier_lock);
+}
+
+/**
+  * switch future calls of ready functions to their optimized code.
+  */
+void tier_install() {
+  int *job, *entry;
+  int i;
+
+  pthread_mutex_lock(&tier_lock);
+  i = 0;
+  while (i < tier_count) {
+    job = tier_jobs + i * TierSize;
+    if (job[TierState] == Ready) {
+      entry = (int*)((int*)job[TierId])[Value];
+      entry[1] = job[TierCode];
+      entry[0] = JMP;
+      job[TierState] = Installed;
+      job[TierInstalled] = tier_counts[entry - old_text];
+    }
+    i++;
+  }
+  tier_ready = 0;
+  pthread_mutex_unlock(&tier_lock);
+}
+
+/**
+  * print counters of every function and the promotion events.
+  */
+void tier_dump() {
+  int *id, *code, *end, *job;
+  int edges, i;
+
+  printf("\ntier stats (threshold %d)\n", tier_threshold);
+  printf("%-16s %10s %10s %5s\n", "function", "calls", "backedges", "tier");
+  id = symbols;
+  while (id[Token]) {
+    if (id[Class] == Fun && id[Value]) {
+      edges = 0;
+      code = (int*)id[Value];
+      end = code + id[Size];
+      while (code < end) {
+        if (*code == JMP && (int*)code[1] < code) {
+          edges = edges + tier_counts[code - old_text];
+        }
+        code = code + ((*code <= ADJ) ? 2 : 1);
+      }
+      i = 0;
+      while (i < tier_count && tier_jobs[i * TierSize + TierId] != (int)id) {
+        i++;
+      }
+      printf("%-16.*s %10d %10d %5d\n", name_length(id), (char*)id[Name],
+             tier_counts[(int*)id[Value] - old_text], edges,
+             (i < tier_count && tier_jobs[i * TierSize + TierState] == Installed));
+    }
+    id = id + IdSize;
+  }
+
+  printf("promotions: %d\n", tier_count);
+  i = 0;
+  while (i < tier_count) {
+    job = tier_jobs + i * TierSize;
+    id = (int*)job[TierId];
+    printf("  %.*s: queued at %d calls, ", name_length(id), (char*)id[Name], job[TierQueued]);
+    if (job[TierState] == Installed) {
+      printf("installed at %d calls, %d -> %d words\n", job[TierInstalled], job[TierOldSize], job[TierNewSize]);
+    } else if (job[TierState] == Failed) {
+      printf("failed, out of tier space\n");
+    } else {
+      printf("not installed\n");
+    }
+    i++;
+  }
+}
+
+/******************************************************************
+stack overflow detection: the stack is mapped with a guard area of
+PROT_NONE pages below its bottom, a PUSH/CALL/ENT into it raises
+SIGSEGV and the handler turns it into a diagnostic, so `eval()` pays
+nothing per instruction. ENT of a frame larger than the guard writes a
+word of every page of it first, so it cannot jump over the guard.
+*******************************************************************/
+char *code;                   // compact bytecode, 0 to run `text`, see compact_encode()
+char *compact_pc;             // instruction of eval_compact() at the last CALL, ENT or LEV
+
+int *compact_text(char *addr);
+char *guard;                  // guard area below the running stack
+int guard_size;
+
+/**
+  * map a stack of `size` bytes with a guard area below it, return its
+  * bottom, the stack grows down from bottom + size.
+  */
+int *new_stack(int size) {
+  char *area;
+
+  guard_size = 16 * sysconf(_SC_PAGESIZE);
+  area = mmap(0, guard_size + size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (area == MAP_FAILED) {
+    return 0;
+  }
+  if (mprotect(area, guard_size, PROT_NONE)) {
+    munmap(area, guard_size + size);
+    return 0;
+  }
+  guard = area;
+  return (int*)(area + guard_size);
+}
+
+/**
+  * write a word of every page of the frame from `top` down to `bottom`,
+  * from the top so that the guard is hit before anything below it.
+  */
+void stack_probe(int *top, int *bottom) {
+  int step;
+
+  step = sysconf(_SC_PAGESIZE) / sizeof(int);
+  while (top > bottom) {
+    top = (top - bottom > step) ? top - step : bottom;
+    *top = 0;
+  }
+}
+
+/**
+  * SIGSEGV handler, report faults in the guard area as stack overflow.
+  */
+void stack_overflow(int sig, siginfo_t *info, void *context) {
+  int *id, *addr;
+
+  if ((char*)info->si_addr >= guard && (char*)info->si_addr < guard + guard_size) {
+    // pc is past the instruction that pushed, eval_compact() keeps its pc
+    // in a local and leaves the last call, entry or return in `compact_pc`
+    addr = code ? (compact_pc ? compact_text(compact_pc) : 0) : pc - 1;
+    printf("\nstack overflow");
+    if (addr) {
+      printf(" at pc %d", addr - old_text);
+    }
+    if (addr && (id = function_at(addr))) {
+      printf(" in %.*s, line %d", name_length(id), (char*)id[Name], line_at(addr));
+    }
+    printf("\n");
+    fflush(stdout);
+    _exit(-1);
+  }
+
+  // not ours, fault again with the default action
+  signal(SIGSEGV, SIG_DFL);
+}
+
+/******************************************************************
+bytecode verifier: verify() walks the code of every function once before
+the program runs. every word must belong to a known instruction, jumps
+must land on an instruction of the same function and CALL/IMMF on the
+entry of a function, ENT must come first and ADJ must not pop below the
+frame. the stack depth is followed along every path and has to be the
+same wherever paths meet. the deepest point of each frame is kept in
+its `Depth` and must fit the stack, so `eval()` can run the code without
+checks of its own.
+*******************************************************************/
+int verify_report;            // print the frame of every function
+char *verify_marks;           // bit 1 at every instruction, bit 2 at every function entry
+int *verify_depths;           // stack depth before every instruction, -1 if not reached
+int **verify_work;            // instructions left to follow by verify_stack()
+
+// arguments read from the stack by OPEN..EXIT
+char *sys_args = "23111332031101";
+
+/**
+  * report bad code at `addr`, return -1.
+  */
+int verify_error(int *addr, char *msg) {
+  int *id;
+
+  id = function_at(addr);
+  printf("%d: bad code at pc %d in %.*s: %s\n", line_at(addr), addr - old_text, name_length(id), (char*)id[Name], msg);
+  return -1;
+}
+
+/**
+  * check the operands of the instructions of function `id`, `marks` has
+  * bit 1 set at every instruction and bit 2 at every function entry.
+  */
+int verify_operands(int *id, char *marks) {
+  int *code, *end, *target;
+  int op;
+
+  code = (int*)id[Value];
+  end = code + id[Size];
+  if (*code == LAZY) {
+    // stub of a function not compiled yet
+    if (id[Size] != 2 || (int*)code[1] < lazy_jobs || (int*)code[1] >= lazy_jobs + lazy_count * LazySize) {
+      return verify_error(code, "bad lazy stub");
+    }
+    return 0;
+  }
+  if (*code != ENT || code[1] < 0) {
+    return verify_error(code, "function does not start with ENT");
+  }
+  while (code < end) {
+    op = *code;
+    target = (int*)code[1];
+    if ((op == JMP || op == JZ || op == JNZ)
+        && (target < (int*)id[Value] || target >= end || !(marks[target - old_text] & 1))) {
+      return verify_error(code, "jump target is not an instruction of the function");
+    }
+    if ((op == CALL || op == IMMF)
+        && (target <= old_text || target > text || !(marks[target - old_text] & 2))) {
+      return verify_error(code, "call target is not a function");
+    }
+    if (op == NATV && (target < symbols || target >= symbol_end || target[Class] != Ext)) {
+      return verify_error(code, "native call of no native function");
+    }
+    if ((op == ENT && code != (int*)id[Value]) || op == LAZY) {
+      return verify_error(code, "ENT or LAZY inside function");
+    }
+    if (op == ADJ && code[1] < 0) {
+      return verify_error(code, "negative ADJ");
+    }
+    if (op == PRTF && (code + 1 >= end || code[1] != ADJ || code[2] < 1)) {
+      // the number of arguments is read from the ADJ after it
+      return verify_error(code, "PRTF without ADJ");
+    }
+    code = code + ((op <= ADJ) ? 2 : 1);
+  }
+  return 0;
+}
+
+/**
+  * follow the stack depth through function `id` and keep its deepest
+  * point in `Depth`. `depths` holds the depth before every instruction
+  * reached so far, -1 if not reached.
+  */
+int verify_stack(int *id, int *depths, int **work) {
+  int *code, *target;
+  int op, base, depth, max, top;
+
+  // words of the frame: saved bp and locals
+  code = (int*)id[Value];
+  if (*code == LAZY) {
+    id[Depth] = 0;
+    return 0;
+  }
+  base = max = 1 + code[1];
+  code = code + 2;
+  depths[code - old_text] = base;
+  work[0] = code;
+  top = 1;
+
+  while (top > 0) {
+    code = work[--top];
+    depth = depths[code - old_text];
+    while (1) {
+      op = *code;
+      if (op == PUSH) {
+        depth++;
+      } else if ((op >= OR && op <= MOD) || (op >= FADD && op <= FGE) || op == SI || op == SC) {
+        depth--;
+      } else if (op == ADJ) {
+        depth = depth - code[1];
+      } else if (op == CALL) {
+        // the return address
+        max = (depth + 1 > max) ? depth + 1 : max;
+      } else if (op >= OPEN && op <= EXIT && depth - base < sys_args[op - OPEN] - '0') {
+        return verify_error(code, "too few arguments");
+      }
+      if (depth < base) {
+        return verify_error(code, "stack underflow");
+      }
+      if (depth > max) {
+        max = depth;
+      }
+
+      if (op == JMP || op == JZ || op == JNZ) {
+        target = (int*)code[1];
+        if (depths[target - old_text] < 0) {
+          depths[target - old_text] = depth;
+          work[top++] = target;
+        } else if (depths[target - old_text] != depth) {
+          return verify_error(code, "stack is unbalanced at jump target");
+        }
+      }
+      if (op == JMP || op == LEV) {
+        break;
+      }
+
+      code = code + ((op <= ADJ) ? 2 : 1);
+      if (code >= (int*)id[Value] + id[Size]) {
+        return verify_error(code - 1, "code runs past the end of the function");
+      }
+      if (depths[code - old_text] >= 0) {
+        if (depths[code - old_text] != depth) {
+          return verify_error(code, "stack is unbalanced at jump target");
+        }
+        break;
+      }
+      depths[code - old_text] = depth;
+    }
+  }
+
+  if (max * sizeof(int) >= poolsize) {
+    return verify_error((int*)id[Value], "frame is larger than the stack");
+  }
+  id[Depth] = max;
+  return 0;
+}
+
+/**
+  * mark the instruction boundaries and the entry of function `id` in
+  * `verify_marks`, return -1 on bad code.
+  */
+int verify_code(int *id) {
+  int *code, *end;
+
+  code = (int*)id[Value];
+  end = code + id[Size];
+  verify_marks[code - old_text] = 2;
+  while (code < end) {
+    if (*code < LEA || *code > EXIT) {
+      return verify_error(code, "unknown instruction");
+    }
+    verify_marks[code - old_text] = verify_marks[code - old_text] | 1;
+    code = code + ((*code <= ADJ) ? 2 : 1);
+  }
+  if (code != end) {
+    return verify_error(end - 1, "operand runs past the end of the function");
+  }
+  return 0;
+}
+
+/**
+  * verify the code of all functions, return -1 on bad code. the marks
+  * and depths are kept for the functions compiled later by lazy_compile().
+  */
+int verify() {
+  int *id;
+  int n, i;
+
+  n = poolsize / sizeof(int) + 1;
+  if (!verify_marks) {
+    verify_marks = malloc(n);
+    verify_depths = malloc(n * sizeof(int));
+    verify_work = malloc(n * sizeof(int));
+  }
+  memset(verify_marks, 0, n);
+  i = 0;
+  while (i < n) {
+    verify_depths[i++] = -1;
+  }
+
+  // instruction boundaries and function entries
+  id = symbols;
+  while (id[Token]) {
+    if (id[Class] == Fun && id[Value] && verify_code(id) < 0) {
+      return -1;
+    }
+    id = id + IdSize;
+  }
+
+  id = symbols;
+  while (id[Token]) {
+    if (id[Class] == Fun && id[Value]) {
+      if (verify_operands(id, verify_marks) < 0 || verify_stack(id, verify_depths, verify_work) < 0) {
+        return -1;
+      }
+    }
+    id = id + IdSize;
+  }
+  return 0;
+}
+
+/**
+  * print the frame of every function, functions not compiled yet have none.
+  */
+void verify_dump() {
+  int *id, *code;
+
+  printf("%-16s %8s %8s %8s\n", "function", "words", "frame", "depth");
+  id = symbols;
+  while (id[Token]) {
+    if (id[Class] == Fun && id[Value]) {
+      code = (int*)id[Value];
+      printf("%-16.*s %8d %8d %8d\n", name_length(id), (char*)id[Name], id[Size], (*code == ENT) ? 1 + code[1] : 0, id[Depth]);
+    }
+    id = id + IdSize;
+  }
+}
+
+/******************************************************************
+lazy compilation: with `-lazy` global_declaration() parses only the
+signature of a function and skip_body() jumps to the matching brace of
+its body. the function gets a stub `LAZY <job>` in `text`, and the first
+CALL reaching it parses the body from the saved source position and
+generates its code after the end of `text`. the stub then becomes a JMP
+to the code, the CALL that reached it is moved to the code and other
+calls and function pointers go through the JMP. only the new code is
+verified. errors in a body are only found once it is called.
+*******************************************************************/
+
+/**
+  * compile the function of `job` whose stub is at `stub`, return the
+  * address of its code. `sp` holds the return address of the call.
+  */
+int *lazy_compile(int *job, int *stub) {
+  int *id, *code, *site;
+
+  id = (int*)job[LazyId];
+  src = (char*)job[LazySrc];
+  line = job[LazyLine];
+  token = '(';
+  return_type = id[Type];
+
+  code = text + 1;
+  lines[code - old_text] = line;
+  lazy = 0;
+  function_declaration(id);
+  lazy = 1;
+  id[Value] = (int)code;
+  id[Size] = text + 1 - code;
+
+  // later calls go straight to the code from this call site, through
+  // the stub from everywhere else
+  stub[0] = JMP;
+  stub[1] = (int)code;
+  site = (int*)*sp - 2;
+  if (site > old_text && site < code && site[0] == CALL && (int*)site[1] == stub) {
+    site[1] = (int)code;
+  }
+
+  if (verify_code(id) < 0 || verify_operands(id, verify_marks) < 0
+      || verify_stack(id, verify_depths, verify_work) < 0) {
+    exit(-1);
+  }
+  return code;
+}
+
+/******************************************************************
+fibers: green threads multiplexed by `eval()`. fiber 0 is the program
+started at main, `spawn(f, arg)` starts `f(arg)` on a small stack of
+its own and `yield()` gives up the rest of the slice. the registers of
+the running fiber live in pc/bp/sp/ax, those of the others in `fibers`.
+the scheduler moves round robin to the next fiber once `cycle` reaches
+`fiber_deadline`, on yield and when a fiber would block in READ. the
+program ends when main returns, a fiber ends when its function does.
+*******************************************************************/
+int *fibers;                  // fiber records, 0 until the first spawn
+int fiber_count;              // records in use, finished ones are reused
+int fiber_live;               // fibers not finished
+int fiber_current;            // index of the running fiber
+int fiber_slice;              // instructions a fiber runs before switching, 0 for no limit
+int fiber_deadline;           // value of `cycle` to switch at, 0 if alone
+int fiber_stack;              // bytes of stack of a spawned fiber
+
+// fields of fiber
+enum {FiberPc, FiberBp, FiberSp, FiberAx, FiberGuard, FiberState, FiberFd, FiberSize};
+
+// states of fiber
+enum {Runnable = 1, Blocked, Finished};
+
+/**
+  * whether READ on `fd` would return without waiting.
+  */
+int fiber_ready(int fd) {
+  struct pollfd p;
+
+  p.fd = fd;
+  p.events = POLLIN;
+  return poll(&p, 1, 0) != 0;
+}
+
+/**
+  * save the registers of the running fiber and resume the next one that
+  * can run, wait for input when all of them are blocked in READ.
+  */
+void fiber_switch() {
+  struct pollfd *wait;
+  int *f;
+  int i, n;
+
+  f = fibers + fiber_current * FiberSize;
+  f[FiberPc] = (int)pc;
+  f[FiberBp] = (int)bp;
+  f[FiberSp] = (int)sp;
+  f[FiberAx] = ax;
+  if (f[FiberState] == Finished) {
+    munmap((char*)f[FiberGuard], guard_size + fiber_stack);
+  }
+
+  i = fiber_current;
+  while (1) {
+    n = 0;
+    while (n < fiber_count) {
+      i = (i + 1) % fiber_count;
+      f = fibers + i * FiberSize;
+      if (f[FiberState] == Blocked && fiber_ready(f[FiberFd])) {
+        f[FiberState] = Runnable;
+      }
+      if (f[FiberState] == Runnable) {
+        break;
+      }
+      n++;
+    }
+    if (n < fiber_count) {
+      break;
+    }
+
+    // nothing to run, sleep until one of the blocked fibers has input
+    wait = malloc(fiber_count * sizeof(struct pollfd));
+    n = 0;
+    while (n < fiber_count) {
+      wait[n].fd = (fibers[n * FiberSize + FiberState] == Blocked) ? fibers[n * FiberSize + FiberFd] : -1;
+      wait[n].events = POLLIN;
+      n++;
+    }
+    poll(wait, fiber_count, -1);
+    free(wait);
+  }
+
+  fiber_current = i;
+  pc = (int*)f[FiberPc];
+  bp = (int*)f[FiberBp];
+  sp = (int*)f[FiberSp];
+  ax = f[FiberAx];
+  guard = (char*)f[FiberGuard];
+  fiber_deadline = (fiber_live > 1 && fiber_slice > 0) ? cycle + fiber_slice : 0;
+}
+
+/**
+  * start `f(arg)` as a new fiber, return its index or -1.
+  */
+int fiber_spawn(int *f, int arg) {
+  int *fiber, *stack_top, *tmp;
+  char *running;
+  int i;
+
+  if (!fibers) {
+    // the running program becomes fiber 0
+    if (!(fibers = malloc(poolsize))) {
+      return -1;
+    }
+    fibers[FiberGuard] = (int)guard;
+    fibers[FiberState] = Runnable;
+    fiber_count = fiber_live = 1;
+  }
+
+  i = 0;
+  while (i < fiber_count && fibers[i * FiberSize + FiberState] != Finished) {
+    i++;
+  }
+  if ((i + 1) * FiberSize * sizeof(int) > poolsize) {
+    return -1;
+  }
+
+  running = guard;
+  stack_top = new_stack(fiber_stack);
+  fiber = fibers + i * FiberSize;
+  fiber[FiberGuard] = (int)guard;
+  guard = running;
+  if (!stack_top) {
+    return -1;
+  }
+
+  // call f(arg) and end the fiber when it returns, like main and EXIT
+  stack_top = (int*)((int)stack_top + fiber_stack);
+  *--stack_top = FEND;
+  tmp = stack_top;
+  *--stack_top = arg;
+  *--stack_top = code ? (int)(code + 2) : (int)tmp;
+  fiber[FiberPc] = (int)f;
+  fiber[FiberBp] = fiber[FiberSp] = (int)stack_top;
+  fiber[FiberAx] = 0;
+  fiber[FiberState] = Runnable;
+  if (i == fiber_count) {
+    fiber_count++;
+  }
+  fiber_live++;
+  fiber_deadline = (fiber_slice > 0) ? cycle + fiber_slice : 0;
+  return i;
+}
+
+/******************************************************************
+asynchronous reads: `aread(fd, buf, n)` submits a read at the current
+position of `fd` and returns a handle, `apoll(h)` tells whether it has
+completed, `await(h)` waits for it and returns what read() would have,
+after which the handle is free again. reads go to io_uring when the
+kernel has it, otherwise to a pool of worker threads doing read(), which
+read one fd at a time in the order of submission. both are set up on
+the first aread() of a process, a forked child drops the requests of
+its parent and sets up its own.
+*******************************************************************/
+int *aio;                     // read requests, indexed by handle
+int aio_depth;                // number of handles
+int aio_ring;                 // io_uring descriptor, -1 for the worker pool
+unsigned *aio_sq_tail, *aio_sq_mask, *aio_sq_array;
+unsigned *aio_cq_head, *aio_cq_tail, *aio_cq_mask;
+struct io_uring_sqe *aio_sqes;
+struct io_uring_cqe *aio_cqes;
+pthread_mutex_t aio_lock;
+pthread_cond_t aio_wake, aio_done;
+int aio_seq;                  // requests submitted, orders the reads of one fd
+int aio_forks;                // aio_fork_child() is registered
+
+// fields of read request
+enum {AioFd, AioBuf, AioCount, AioSeq, AioState, AioResult, AioSize};
+
+// states of read request, 0 is a free handle
+enum {Pending = 1, Reading, Completed};
+
+/**
+  * the pending request to read next, the oldest one whose fd has no
+  * read going on and no older request waiting, 0 if there is none.
+  * called with aio_lock held.
+  */
+int *aio_next() {
+  int *req, *other;
+  int i, j;
+
+  req = 0;
+  i = 0;
+  while (i < aio_depth) {
+    other = aio + i * AioSize;
+    if (other[AioState] == Pending && (!req || other[AioSeq] < req[AioSeq])) {
+      j = 0;
+      while (j < aio_depth && !(aio[j * AioSize + AioFd] == other[AioFd]
+             && (aio[j * AioSize + AioState] == Reading
+                 || (aio[j * AioSize + AioState] == Pending && aio[j * AioSize + AioSeq] < other[AioSeq])))) {
+        j++;
+      }
+      if (j == aio_depth) {
+        req = other;
+      }
+    }
+    i++;
+  }
+  return req;
+}
+
+/**
+  * worker of the pool, do pending reads one by one.
+  */
+void *aio_worker(void *arg) {
+  int *req;
+  int n;
+
+  while (1) {
+    pthread_mutex_lock(&aio_lock);
+    while (!(req = aio_next())) {
+      pthread_cond_wait(&aio_wake, &aio_lock);
+    }
+    req[AioState] = Reading;
+    pthread_mutex_unlock(&aio_lock);
+
+    n = read(req[AioFd], (char*)req[AioBuf], req[AioCount]);
+
+    // the next read of the fd may go on now
+    pthread_mutex_lock(&aio_lock);
+    req[AioResult] = n;
+    req[AioState] = Completed;
+    pthread_cond_broadcast(&aio_done);
+    pthread_cond_signal(&aio_wake);
+    pthread_mutex_unlock(&aio_lock);
+  }
+  return 0;
+}
+
+/**
+  * in a forked child forget the requests of the parent, its ring and
+  * workers stay with the parent. the child sets up its own on its
+  * first aread().
+  */
+void aio_fork_child() {
+  if (aio && aio_ring >= 0) {
+    close(aio_ring);
+  }
+  free(aio);
+  aio = 0;
+}
+
+/**
+  * map the rings of io_uring, or start the worker pool when the kernel
+  * can't do reads through it. return 0 on success.
+  */
+int aio_setup() {
+  struct io_uring_params params;
+  pthread_t worker;
+  char *sq, *cq;
+  int i;
+
+  aio_depth = 256;
+  if (!(aio = malloc(aio_depth * AioSize * sizeof(int)))) {
+    return -1;
+  }
+  memset(aio, 0, aio_depth * AioSize * sizeof(int));
+  if (!aio_forks) {
+    pthread_atfork(0, 0, aio_fork_child);
+    aio_forks = 1;
+  }
+
+  // reads at the current position (offset -1) need IORING_FEAT_RW_CUR_POS
+  memset(&params, 0, sizeof(params));
+  aio_ring = syscall(__NR_io_uring_setup, aio_depth, &params);
+  if (aio_ring >= 0 && !(params.features & IORING_FEAT_RW_CUR_POS)) {
+    close(aio_ring);
+    aio_ring = -1;
+  }
+  if (aio_ring >= 0) {
+    sq = mmap(0, params.sq_off.array + params.sq_entries * sizeof(unsigned), PROT_READ | PROT_WRITE,
+              MAP_SHARED | MAP_POPULATE, aio_ring, IORING_OFF_SQ_RING);
+    cq = mmap(0, params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe), PROT_READ | PROT_WRITE,
+              MAP_SHARED | MAP_POPULATE, aio_ring, IORING_OFF_CQ_RING);
+    aio_sqes = mmap(0, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, aio_ring, IORING_OFF_SQES);
+    if (sq != MAP_FAILED && cq != MAP_FAILED && aio_sqes != MAP_FAILED) {
+      aio_sq_tail = (unsigned*)(sq + params.sq_off.tail);
+      aio_sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+      aio_sq_array = (unsigned*)(sq + params.sq_off.array);
+      aio_cq_head = (unsigned*)(cq + params.cq_off.head);
+      aio_cq_tail = (unsigned*)(cq + params.cq_off.tail);
+      aio_cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+      aio_cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+      return 0;
+    }
+    close(aio_ring);
+    aio_ring = -1;
+  }
+
+  pthread_mutex_init(&aio_lock, 0);
+  pthread_cond_init(&aio_wake, 0);
+  pthread_cond_init(&aio_done, 0);
+  i = 0;
+  while (i < 4) {
+    if (pthread_create(&worker, 0, aio_worker, 0)) {
+      return -1;
+    }
+    i++;
+  }
+  return 0;
+}
+
+/**
+  * move finished reads of io_uring to their requests.
+  */
+void aio_reap() {
+  struct io_uring_cqe *cqe;
+  unsigned head;
+
+  head = *aio_cq_head;
+  while (head != __atomic_load_n(aio_cq_tail, __ATOMIC_ACQUIRE)) {
+    cqe = aio_cqes + (head & *aio_cq_mask);
+    aio[cqe->user_data * AioSize + AioResult] = (cqe->res < 0) ? -1 : cqe->res;
+    aio[cqe->user_data * AioSize + AioState] = Completed;
+    head++;
+  }
+  __atomic_store_n(aio_cq_head, head, __ATOMIC_RELEASE);
+}
+
+/**
+  * start reading `count` bytes of `fd` into `buf`, return the handle or -1.
+  */
+int aio_submit(int fd, char *buf, int count) {
+  struct io_uring_sqe *sqe;
+  unsigned tail;
+  int *req;
+  int h;
+
+  if (!aio && aio_setup()) {
+    return -1;
+  }
+
+  if (aio_ring < 0) {
+    pthread_mutex_lock(&aio_lock);
+  }
+  h = 0;
+  while (h < aio_depth && aio[h * AioSize + AioState]) {
+    h++;
+  }
+  if (h == aio_depth) {
+    if (aio_ring < 0) {
+      pthread_mutex_unlock(&aio_lock);
+    }
+    return -1;
+  }
+  req = aio + h * AioSize;
+  req[AioFd] = fd;
+  req[AioBuf] = (int)buf;
+  req[AioCount] = count;
+  req[AioSeq] = aio_seq++;
+  req[AioState] = Pending;
+
+  if (aio_ring < 0) {
+    pthread_cond_signal(&aio_wake);
+    pthread_mutex_unlock(&aio_lock);
+    return h;
+  }
+
+  // one entry per handle, the submission ring never fills up
+  tail = *aio_sq_tail;
+  sqe = aio_sqes + (tail & *aio_sq_mask);
+  memset(sqe, 0, sizeof(struct io_uring_sqe));
+  sqe->opcode = IORING_OP_READ;
+  sqe->fd = fd;
+  sqe->addr = (int)buf;
+  sqe->len = count;
+  sqe->off = -1;
+  sqe->user_data = h;
+  aio_sq_array[tail & *aio_sq_mask] = tail & *aio_sq_mask;
+  __atomic_store_n(aio_sq_tail, tail + 1, __ATOMIC_RELEASE);
+  syscall(__NR_io_uring_enter, aio_ring, 1, 0, 0, 0, 0);
+  return h;
+}
+
+/**
+  * whether the read of handle `h` has completed, -1 for a bad handle.
+  */
+int aio_poll(int h) {
+  int state;
+
+  if (!aio || h < 0 || h >= aio_depth) {
+    return -1;
+  }
+  if (aio_ring >= 0) {
+    aio_reap();
+    state = aio[h * AioSize + AioState];
+  } else {
+    pthread_mutex_lock(&aio_lock);
+    state = aio[h * AioSize + AioState];
+    pthread_mutex_unlock(&aio_lock);
+  }
+  return state ? state == Completed : -1;
+}
+
+/**
+  * wait for the read of handle `h`, free the handle and return its result.
+  */
+int aio_wait(int h) {
+  int *req;
+  int result;
+
+  if (aio_poll(h) < 0) {
+    return -1;
+  }
+  req = aio + h * AioSize;
+  if (aio_ring >= 0) {
+    while (req[AioState] != Completed) {
+      syscall(__NR_io_uring_enter, aio_ring, 0, 1, IORING_ENTER_GETEVENTS, 0, 0);
+      aio_reap();
+    }
+    req[AioState] = 0;
+    return req[AioResult];
+  }
+
+  // the workers change the request under the lock only
+  pthread_mutex_lock(&aio_lock);
+  while (req[AioState] != Completed) {
+    pthread_cond_wait(&aio_done, &aio_lock);
+  }
+  req[AioState] = 0;
+  result = req[AioResult];
+  pthread_mutex_unlock(&aio_lock);
+  return result;
+}
+
+/******************************************************************
+watchdog: with `-max-cycles n` a program may take n backward jumps and
+calls, every loop and every recursion pass through one of them, so
+straight line code is not counted. the program is stopped with exit
+status 124 when it takes more and the function and line are reported.
+*******************************************************************/
+int max_cycles;               // backward jumps and calls allowed, 0 for no limit
+int cycles_left;              // backward jumps and calls still allowed
+
+/**
+  * limit the program to `n` backward jumps and calls from now on, 0 to
+  * remove the limit.
+  */
+void set_max_cycles(int n) {
+  max_cycles = cycles_left = n;
+}
+
+/**
+  * report the exhausted limit at instruction `addr`, return the exit status.
+  */
+int watchdog(int *addr) {
+  int *id;
+
+  printf("\ncycle limit of %d reached", max_cycles);
+  if ((id = function_at(addr))) {
+    printf(" in %.*s, line %d", name_length(id), (char*)id[Name], line_at(addr));
+  }
+  printf("\n");
+  return 124;
+}
+
+/******************************************************************
+fork server: with `-serve path` the program runs as usual up to its
+first call of `snapshot()`, then listens on the unix socket `path`.
+every connection is served by a fork of the warmed up VM, in which
+`snapshot()` returns the number of the request and the program goes on
+with the connection as its stdin and stdout. when it has ended the
+server writes `exit status <n>` as the last line. without -serve
+`snapshot()` returns 0 at once.
+*******************************************************************/
+char *serve_path;             // socket to listen on, 0 to run once
+int serve_count;              // requests accepted
+
+/**
+  * listen on `serve_path` and return in a fork for every request.
+  */
+int snapshot() {
+  struct sockaddr_un addr;
+  int s, c, pid, status;
+
+  if (!serve_path) {
+    return 0;
+  }
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, serve_path, sizeof(addr.sun_path) - 1);
+  unlink(serve_path);
+  s = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (s < 0 || bind(s, (struct sockaddr*)&addr, sizeof(addr)) || listen(s, 64)) {
+    printf("could not listen on (%s)\n", serve_path);
+    exit(-1);
+  }
+  printf("serving on %s\n", serve_path);
+  fflush(stdout);
+
+  // the handlers are not waited for
+  signal(SIGCHLD, SIG_IGN);
+  while (1) {
+    if ((c = accept(s, 0, 0)) < 0) {
+      continue;
+    }
+    serve_count++;
+    if (!fork()) {
+      // handler, run the request and report how it ended
+      close(s);
+      signal(SIGCHLD, SIG_DFL);
+      if (!(pid = fork())) {
+        // every request has the whole limit of cycles
+        cycles_left = max_cycles;
+        dup2(c, 0);
+        dup2(c, 1);
+        close(c);
+        return serve_count;
+      }
+      waitpid(pid, &status, 0);
+      status = WIFEXITED(status) ? WEXITSTATUS(status) : -WTERMSIG(status);
+      dprintf(c, "\nexit status %d\n", status);
+      _exit(0);
+    }
+    close(c);
+  }
+  return 0;
+}
+
+/******************************************************************
+batch runner: with `-batch n` every argument after the source file is
+an input, the compiled program runs once per input with it as argv[1],
+in up to n forked processes at a time. the output of every run goes
+to a temporary file, which is printed and closed with the exit status
+and time of the run once all runs before it have been printed, at the
+end follow the throughput and the percentiles of the time per input.
+*******************************************************************/
+int batch_workers;            // processes running at a time, 0 to run once
+int *batch;                   // runs, indexed like the inputs
+int batch_failed;             // runs that could not start or exited with nonzero status
+
+// fields of run
+enum {BatchPid, BatchOutput, BatchStart, BatchTime, BatchStatus, BatchSize};
+
+/**
+  * microseconds of wall clock time.
+  */
+int batch_clock() {
+  struct timeval now;
+
+  gettimeofday(&now, 0);
+  return now.tv_sec * 1000000 + now.tv_usec;
+}
+
+int compare_ints(const void *a, const void *b) {
+  return (*(int*)a > *(int*)b) - (*(int*)a < *(int*)b);
+}
+
+/**
+  * print the output of finished run `i` of input `input` and close it.
+  */
+void batch_print(int i, char *input) {
+  int *run;
+  int n;
+  char buffer[4096];
+
+  run = batch + i * BatchSize;
+  printf("== %s: exit status %d, %d us ==\n", input, run[BatchStatus], run[BatchTime]);
+  fflush(stdout);
+  if (!run[BatchOutput]) {
+    printf("could not run (%s)\n", input);
+  } else {
+    rewind((FILE*)run[BatchOutput]);
+    while ((n = fread(buffer, 1, sizeof(buffer), (FILE*)run[BatchOutput])) > 0) {
+      fwrite(buffer, 1, n, stdout);
+    }
+    fclose((FILE*)run[BatchOutput]);
+  }
+  printf("\n");
+}
+
+/**
+  * run the program once for each of `count` inputs, return the index of
+  * the input in a forked run and -1 in the parent once all are printed.
+  * a run is printed as soon as it and all before it have ended, so at
+  * most `4 * batch_workers` outputs are open at a time.
+  */
+int batch_run(char **inputs, int count) {
+  int *run, *times;
+  int i, next, running, printed, pid, status, start;
+
+  batch = malloc(count * BatchSize * sizeof(int));
+  times = malloc(count * sizeof(int));
+  memset(batch, 0, count * BatchSize * sizeof(int));
+  start = batch_clock();
+  next = running = printed = 0;
+  while (printed < count) {
+    while (running < batch_workers && next < count && next - printed < 4 * batch_workers) {
+      run = batch + next * BatchSize;
+      run[BatchStart] = batch_clock();
+      fflush(stdout);
+      if (!(run[BatchOutput] = (int)tmpfile()) || (pid = fork()) < 0) {
+        // this input fails, the others go on
+        if (run[BatchOutput]) {
+          fclose((FILE*)run[BatchOutput]);
+          run[BatchOutput] = 0;
+        }
+        run[BatchStatus] = -1;
+        run[BatchPid] = -1;
+        next++;
+        continue;
+      }
+      if (!pid) {
+        dup2(fileno((FILE*)run[BatchOutput]), 1);
+        return next;
+      }
+      run[BatchPid] = pid;
+      running++;
+      next++;
     }
 
-    current_id[Class] = Num;
-    current_id[Type] = INT;
-    current_id[Value] = i++;
+    if (running) {
+      pid = wait(&status);
+      i = printed;
+      while (i < next && batch[i * BatchSize + BatchPid] != pid) {
+        i++;
+      }
+      if (i < next) {
+        run = batch + i * BatchSize;
+        run[BatchTime] = batch_clock() - run[BatchStart];
+        run[BatchStatus] = WIFEXITED(status) ? WEXITSTATUS(status) : -WTERMSIG(status);
+        run[BatchPid] = 0;
+        running--;
+      }
+    }
 
-    if (token == ',') {
-      next();
+    // print the runs that ended in the order of the inputs
+    while (printed < next && batch[printed * BatchSize + BatchPid] <= 0) {
+      run = batch + printed * BatchSize;
+      if (run[BatchStatus]) {
+        batch_failed++;
+      }
+      times[printed] = run[BatchTime];
+      batch_print(printed, inputs[printed]);
+      printed++;
     }
+  }
+  start = batch_clock() - start;
+
+  qsort(times, count, sizeof(int), compare_ints);
+  printf("batch: %d inputs on %d workers in %d ms, %d inputs/s, %d failed\n", count, batch_workers,
+         start / 1000, start ? (int)(count * 1000000.0 / start) : 0, batch_failed);
+  printf("latency us: p50 %d, p90 %d, p99 %d, max %d\n", times[count * 50 / 100],
+         times[count * 90 / 100], times[count * 99 / 100], times[count - 1]);
+  free(times);
+  return -1;
+}
+
+/******************************************************************
+memory report: with `-mem` the use of every area is printed at exit.
+the deepest point of the stack is found without any cost in `eval()`:
+the stack is mapped fresh, so exactly the pages the program has
+reached are resident, mincore() tells which ones.
+*******************************************************************/
+int mem_report;               // print the memory report at exit
+int malloc_calls;             // calls of malloc() by the program
+int malloc_bytes;             // bytes asked for by them
 
+/**
+  * bytes of the stack from its top down to the deepest page touched.
+  */
+int stack_depth() {
+  unsigned char *resident;
+  int page, pages, i;
+
+  page = sysconf(_SC_PAGESIZE);
+  pages = (poolsize + page - 1) / page;
+  resident = malloc(pages);
+  if (mincore((char*)stack, pages * page, resident)) {
+    free(resident);
+    return -1;
+  }
+  i = 0;
+  while (i < pages && !(resident[i] & 1)) {
+    i++;
   }
+  free(resident);
+  return (pages - i) * page;
 }
 
-void global_declaration() {
-  // global_declaration ::= enum_decl | variable_decl | function_decl
-  // enum_decl ::= 'enum' [id] '{' id ['=' 'num'] {',' id ['=' 'num'} '}'
-  // variable_decl ::= type {'*'} id { ',' {'*'} id } ';'
-  // function_decl ::= type {'*'} id '(' parameter_decl ')' '{' body_decl '}'
+/**
+  * print bytes used and reserved of every area.
+  */
+void mem_dump() {
+  printf("\nmemory used / reserved\n");
+  printf("  text     %10d / %d bytes\n", (text - old_text) * sizeof(int), poolsize);
+  printf("  data     %10d / %d bytes\n", data - old_data, poolsize);
+  printf("  symbols  %10d / %d entries\n", (symbol_end - symbols) / IdSize, poolsize / (IdSize * sizeof(int)));
+  printf("  stack    %10d / %d bytes, to the page\n", stack_depth(), poolsize);
+  printf("  malloc   %10d bytes in %d calls\n", malloc_bytes, malloc_calls);
+}
 
-  int type;           // type for variable
-  int i;
+/******************************************************************
+sampling profiler: with `-sample file` a profiling timer interrupts the
+program every millisecond of cpu time and the handler copies `pc` and
+the return address of every frame on the `bp` chain built by ENT into
+`samples`. at exit the addresses are mapped to function and line with
+`lines` and the stacks are written collapsed, `main:30;fib:4 57` per
+line, as flamegraph.pl takes them.
+*******************************************************************/
+char *sample_file;            // file for the profile, 0 to disable
+int *samples;                 // stacks, each is its depth then addresses from the leaf up
+int *sample_top, *sample_end; // free space in `samples`
+int sample_count;             // stacks recorded
+int sample_lost;              // stacks dropped when `samples` was full
 
-  // parse enum, this should be treated alone
-  if (token == Enum) {
-    // enum [id] {a = 10, b= 20, ... }
-    match(Enum);
-    if (token != '{') {
-      // skip the [id] part
-      match(Id);
-    }
-    if (token == '{') {
-      // parse the assign part
-      match('{');
-      enum_declaration();
-      match('}');
-    }
+/**
+  * SIGPROF handler, record the stack of the running program.
+  */
+void sample(int sig) {
+  int *frame, *top, *record;
+  int depth;
 
-    match(';');
+  if (sample_top + 64 > sample_end) {
+    sample_lost++;
     return;
   }
 
-  // parse type information
-  if (token == Int) {
-    match(Int);
-  } else if (token == Char) {
-    match(Char);
-    base_type = CHAR;
+  // frames above the top of the stack belong to nobody
+  if (fibers && fiber_current) {
+    top = (int*)(guard + guard_size + fiber_stack);
+  } else {
+    top = (int*)((int)stack + poolsize);
   }
 
-  // parse the comma seperated variable declaration
-  while (token != ';' && token != '}') {
-    type = base_type;
-    // parse pointer type, note that there may exist `int ****x;`
-    while (token == Mul) {
-      match(Mul);
-      type = type + PTR;
+  record = sample_top;
+  depth = 0;
+  record[++depth] = (int)pc;
+  frame = bp;
+  while (depth < 63 && frame >= (int*)(guard + guard_size) && frame + 1 < top) {
+    record[++depth] = frame[1];
+    if ((int*)frame[0] <= frame) {
+      break;
     }
+    frame = (int*)frame[0];
+  }
+  record[0] = depth;
+  sample_top = record + depth + 1;
+  sample_count++;
+}
 
-    if (token != Id) {
-      // invalid declaration
-      printf("%d: bad global declaration\n", line);
-      exit(-1);
+/**
+  * function containing `addr`, also in optimized code of the hot tier.
+  */
+int *sample_function(int *addr) {
+  int *job;
+  int i;
+
+  if (addr > old_text && addr <= text) {
+    return function_at(addr);
+  }
+  i = 0;
+  while (i < tier_count) {
+    job = tier_jobs + i * TierSize;
+    if (job[TierCode] && (int*)job[TierCode] <= addr && addr < (int*)job[TierCode] + job[TierNewSize]) {
+      return (int*)job[TierId];
     }
+    i++;
+  }
+  return 0;
+}
 
-    if (current_id[Class]) {
-      // identifier exists
-      printf("%d: duplicate global declaration\n", line);
-      exit(-1);
+int compare_stacks(const void *a, const void *b) {
+  return strcmp(*(char**)a, *(char**)b);
+}
+
+/**
+  * write the recorded stacks collapsed, identical stacks counted once.
+  */
+void sample_dump() {
+  char **stacks, *out;
+  int *record, *addr, *id;
+  int i, j, n;
+  FILE *f;
+
+  if (!(f = fopen(sample_file, "w"))) {
+    printf("could not open (%s)\n", sample_file);
+    return;
+  }
+
+  // one string per stack, outermost frame first
+  stacks = malloc((sample_count + 1) * sizeof(char*));
+  record = samples;
+  i = 0;
+  while (i < sample_count) {
+    out = stacks[i] = malloc(record[0] * 80 + 1);
+    *out = 0;
+    j = record[0];
+    while (j > 0) {
+      // a return address is past its CALL, leaf pc is the next instruction
+      addr = (int*)record[j] - 1;
+      if ((id = sample_function(addr))) {
+        out = out + sprintf(out, "%s%.*s:%d", (out == stacks[i]) ? "" : ";",
+                            (name_length(id) < 64) ? name_length(id) : 64, (char*)id[Name], line_at(addr));
+      }
+      j--;
     }
-    match(Id);
-    current_id[Type] = type;
+    record = record + record[0] + 1;
+    i++;
+  }
 
-    if (token == '(') {
-      current_id[Class] = Fun;
-      current_id[Value] = (int)(text + 1);    // the memory address of function
-      function_declaration();
-    } else {
-      current_id[Class] = Glo;
-      current_id[Value] = (int)data;          // assign memory address
-      data = data + sizeof(int);
+  qsort(stacks, sample_count, sizeof(char*), compare_stacks);
+  i = 0;
+  while (i < sample_count) {
+    n = 1;
+    while (i + n < sample_count && !strcmp(stacks[i], stacks[i + n])) {
+      n++;
+    }
+    if (*stacks[i]) {
+      fprintf(f, "%s %d\n", stacks[i], n);
     }
+    i = i + n;
+  }
+  fclose(f);
 
-    if (token == ',') {
-      match(',');
+  printf("\nsampled %d stacks into %s", sample_count, sample_file);
+  if (sample_lost) {
+    printf(", %d lost", sample_lost);
+  }
+  printf("\n");
+
+  i = 0;
+  while (i < sample_count) {
+    free(stacks[i++]);
+  }
+  free(stacks);
+}
+
+/******************************************************************
+compact bytecode: with `-compact` the finished `text` is encoded into
+bytes before it runs. the low 6 bits of the first byte of an
+instruction are its opcode, the top 2 bits tell whether its operand
+takes 1, 2, 4 or sizeof(int) bytes. the targets of jumps and calls and
+the addresses of functions are stored relative to the instruction, so
+most of them fit a byte or two. `eval_compact()` runs the encoded
+program on the same registers, return addresses point into `code`.
+symbols keep the addresses of functions in `text`.
+*******************************************************************/
+int compact;                  // run compact bytecode instead of `text`
+int code_size;                // bytes of `code`
+int *code_offsets;            // offset in `code` of every word of `text`
+
+// widths of operand, the top 2 bits of an instruction
+enum {Byte1, Byte2, Byte4, ByteWord};
+
+/**
+  * operand of the instruction at `text[i]` in the layout `offsets`.
+  */
+int compact_value(int i, int *offsets) {
+  int op;
+
+  op = old_text[i];
+  if (op == JMP || op == JZ || op == JNZ || op == CALL || op == IMMF) {
+    return offsets[(int*)old_text[i + 1] - old_text] - offsets[i];
+  }
+  return old_text[i + 1];
+}
+
+/**
+  * encode `text` into `code`, return its size in bytes. the code starts
+  * with `PUSH EXIT` for main and `FEND` for fibers to return to.
+  */
+int compact_encode() {
+  int *offsets, *widths;
+  int i, n, op, v, w, pos, changed;
+  char *p;
+
+  n = text - old_text;
+  offsets = code_offsets = malloc((n + 2) * sizeof(int));
+  widths = malloc((n + 2) * sizeof(int));
+  memset(widths, 0, (n + 2) * sizeof(int));
+
+  // start every operand in one byte and widen until the layout is stable
+  changed = 1;
+  while (changed) {
+    changed = 0;
+    pos = 3;
+    i = 1;
+    while (i <= n) {
+      offsets[i] = pos++;
+      if (old_text[i] <= ADJ) {
+        w = widths[i];
+        pos = pos + (w == Byte1 ? 1 : w == Byte2 ? 2 : w == Byte4 ? 4 : sizeof(int));
+        offsets[++i] = pos - 1;
+      }
+      i++;
+    }
+    offsets[n + 1] = pos;
+
+    i = 1;
+    while (i <= n) {
+      if (old_text[i] <= ADJ) {
+        v = compact_value(i, offsets);
+        w = (v >= -128 && v < 128) ? Byte1 : (v >= -32768 && v < 32768) ? Byte2
+          : (v >= -2147483647 - 1 && v <= 2147483647) ? Byte4 : ByteWord;
+        if (w > widths[i]) {
+          widths[i] = w;
+          changed = 1;
+        }
+        i++;
+      }
+      i++;
     }
   }
 
-  next();
+  if (!(code = malloc(pos))) {
+    printf("could not malloc (%d) for compact code\n", pos);
+    exit(-1);
+  }
+  code[0] = PUSH;
+  code[1] = EXIT;
+  code[2] = FEND;
+  i = 1;
+  while (i <= n) {
+    p = code + offsets[i];
+    op = old_text[i];
+    if (op > ADJ) {
+      *p = op;
+      i++;
+    } else {
+      w = widths[i];
+      v = compact_value(i, offsets);
+      *p++ = op | (w << 6);
+      if (w == Byte1)      *(int8_t*)p = v;
+      else if (w == Byte2) *(int16_t*)p = v;
+      else if (w == Byte4) *(int32_t*)p = v;
+      else                 *(int*)p = v;
+      i = i + 2;
+    }
+  }
+
+  free(widths);
+  return pos;
 }
 
 /**
-  * entry of grammar parse.
+  * address in `text` of the instruction encoded at `addr` in `code`,
+  * for reports by function and line.
   */
-void program() {
-  next();
-  while (token > 0) {
-    global_declaration();
+int *compact_text(char *addr) {
+  int lo, hi, mid;
+
+  lo = 1;
+  hi = text - old_text;
+  while (lo < hi) {
+    mid = (lo + hi + 1) / 2;
+    if (code_offsets[mid] <= addr - code) {
+      lo = mid;
+    } else {
+      hi = mid - 1;
+    }
   }
-  return;
+  return old_text + lo;
+}
+
+/**
+  * operand of the compact instruction at `p`.
+  */
+int compact_operand(char *p) {
+  int w;
+
+  w = (*p >> 6) & 3;
+  if (w == Byte1) return *(int8_t*)(p + 1);
+  if (w == Byte2) return *(int16_t*)(p + 1);
+  if (w == Byte4) return *(int32_t*)(p + 1);
+  return *(int*)(p + 1);
 }
 
 /**
@@ -1266,21 +4960,64 @@ void program() {
   */
 int eval() {
   int op, *tmp;
-  while (op = *pc++) {
+  while (1) {
+    if (++cycle == fiber_deadline) {
+      // the slice of the running fiber is used up
+      fiber_switch();
+    }
+    op = *pc++;
     if (op == IMM)      {ax = *pc++;}                   // load immediate value to ax
     else if (op == LC)  {ax = *(char*)ax;}              // load character to ax, address in ax
     else if (op == LI)  {ax = *(int*)ax;}               // load integer to ax, address in ax
     else if (op == SC)  {*(char*)*sp++ = ax;}           // store character as address to stack
     else if (op == SI)  {*(int*)*sp++ = ax;}            // store integer as address to stack
     else if (op == PUSH){*--sp = ax;}                   // push the value of ax onto the stack
-    else if (op == JMP) {pc = (int*)*pc;}               // jump to the address
+    else if (op == JMP) {                               // jump to the address, count back-edges
+      if ((int*)*pc < pc) {
+        if (tier_threshold && ++tier_counts[pc - 1 - old_text] == tier_threshold) {
+          tier_promote(pc - 1);
+        }
+        if (max_cycles && --cycles_left < 0) {
+          return watchdog(pc - 1);
+        }
+      }
+      pc = (int*)*pc;
+    }
     else if (op == JZ)  {pc = ax ? pc + 1 : (int*)*pc;} // jump if ax is zero
     else if (op == JNZ) {pc = ax ? (int*)*pc : pc + 1;} // jump if ax is not zero
-    else if (op == CALL){*--sp = (int)(pc + 1); pc = (int*)*pc;}        // call subroutine
-    else if (op == ENT) {*--sp = (int)bp; bp = sp; sp = sp - *pc++;}    // make new stack frame
+    else if (op == CALL){                               // call subroutine, count calls
+      if (max_cycles && --cycles_left < 0) {
+        return watchdog(pc - 1);
+      }
+      *--sp = (int)(pc + 1);
+      pc = (int*)*pc;
+      if (tier_threshold) {
+        if (++tier_counts[pc - old_text] == tier_threshold) {
+          tier_promote(pc);
+        }
+        if (tier_ready) {
+          tier_install();
+        }
+      }
+    }
+    else if (op == ENT) {                               // make new stack frame
+      *--sp = (int)bp;
+      bp = sp;
+      sp = sp - *pc++;
+      if (pc[-1] * sizeof(int) >= guard_size) {
+        stack_probe(bp, sp);
+      }
+    }
     else if (op == ADJ) {sp = sp + *pc++;}              // remove arguments from frame
     else if (op == LEV) {sp = bp; bp = (int*)*sp++; pc = (int*)*sp++;}  // restore old call frame
     else if (op == LEA) {ax = (int)(bp + *pc++);}       // load address for arguments
+    else if (op == ADDI){ax = ax + *pc++;}              // add offset, address of struct member
+    else if (op == IMMF){ax = *pc++;}                   // load address of function
+    else if (op == LAZY){pc = lazy_compile((int*)*pc, pc - 1);}  // compile function on first call
+    else if (op == NATV){                               // call native function, args as for PRTF
+      tmp = sp + ((int*)*pc)[Params];
+      ax = ((int (*)())((int*)*pc++)[Value])(tmp[-1], tmp[-2], tmp[-3], tmp[-4], tmp[-5], tmp[-6]);
+    }
     
     // binary-operations
     else if (op == OR)  ax = *sp++ | ax;
@@ -1300,15 +5037,59 @@ int eval() {
     else if (op == DIV) ax = *sp++ / ax;
     else if (op == MOD) ax = *sp++ % ax;
 
+    // floating point, doubles are held in one word
+    else if (op == FADD) ax = double_bits(bits_double(*sp++) + bits_double(ax));
+    else if (op == FSUB) ax = double_bits(bits_double(*sp++) - bits_double(ax));
+    else if (op == FMUL) ax = double_bits(bits_double(*sp++) * bits_double(ax));
+    else if (op == FDIV) ax = double_bits(bits_double(*sp++) / bits_double(ax));
+    else if (op == FEQ)  ax = bits_double(*sp++) == bits_double(ax);
+    else if (op == FNE)  ax = bits_double(*sp++) != bits_double(ax);
+    else if (op == FLT)  ax = bits_double(*sp++) <  bits_double(ax);
+    else if (op == FGT)  ax = bits_double(*sp++) >  bits_double(ax);
+    else if (op == FLE)  ax = bits_double(*sp++) <= bits_double(ax);
+    else if (op == FGE)  ax = bits_double(*sp++) >= bits_double(ax);
+    else if (op == ITOF) ax = double_bits((double)ax);
+    else if (op == FTOI) ax = (int)bits_double(ax);
+
     // inner functions
+    else if (op == SNAP) { ax = snapshot();}
     else if (op == EXIT) { printf("exit(%d)", *sp); return *sp;}
     else if (op == OPEN) { ax = open((char *)sp[1], sp[0]); }
     else if (op == CLOS) { ax = close(*sp);}
-    else if (op == READ) { ax = read(sp[2], (char *)sp[1], *sp); }
-    else if (op == PRTF) { tmp = sp + pc[1]; ax = printf((char *)tmp[-1], tmp[-2], tmp[-3], tmp[-4], tmp[-5], tmp[-6]); }
-    else if (op == MALC) { ax = (int)malloc(*sp);}
+    else if (op == READ) {
+      if (fiber_live > 1 && !fiber_ready(sp[2])) {
+        // let the other fibers run, READ again when there is input
+        pc--;
+        fibers[fiber_current * FiberSize + FiberState] = Blocked;
+        fibers[fiber_current * FiberSize + FiberFd] = sp[2];
+        fiber_switch();
+      } else {
+        ax = read(sp[2], (char *)sp[1], *sp);
+      }
+    }
+    else if (op == PRTF) { tmp = sp + pc[1]; ax = print_format((char *)tmp[-1], tmp - 2); }
+    else if (op == MALC) { ax = (int)malloc(*sp); malloc_calls++; malloc_bytes = malloc_bytes + *sp;}
     else if (op == MSET) { ax = (int)memset((char *)sp[2], sp[1], *sp);}
     else if (op == MCMP) { ax = memcmp((char *)sp[2], (char *)sp[1], *sp);}
+    else if (op == SPWN) { ax = fiber_spawn((int *)sp[1], *sp);}
+    else if (op == YILD) { ax = fiber_live - 1; if (ax > 0) fiber_switch();}
+    else if (op == ARED) { ax = aio_submit(sp[2], (char *)sp[1], *sp);}
+    else if (op == APOL) { ax = aio_poll(*sp);}
+    else if (op == AWAT) {
+      if (fiber_live > 1 && !aio_poll(*sp)) {
+        // let the other fibers run, wait again on the next turn
+        pc--;
+        fiber_switch();
+      } else {
+        ax = aio_wait(*sp);
+      }
+    }
+    else if (op == FEND) {
+      // the function of a spawned fiber returned
+      fibers[fiber_current * FiberSize + FiberState] = Finished;
+      fiber_live--;
+      fiber_switch();
+    }
 
     // unknown instructions
     else {
@@ -1319,20 +5100,283 @@ int eval() {
   return 0;
 }
 
+/**
+  * switch fibers from eval_compact(), which keeps the registers
+  * `sp`, `bp`, `ax` in locals and `pc` is already saved.
+  */
+char *compact_switch(int *s, int *b, int a, int **ps, int **pb, int *pa) {
+  sp = s;
+  bp = b;
+  ax = a;
+  fiber_switch();
+  *ps = sp;
+  *pb = bp;
+  *pa = ax;
+  return (char*)pc;
+}
+
+/**
+  * virtual machine for compact bytecode. the registers are kept in
+  * locals, `pc`, `lbp`, `lsp` and `lax` are only up to date while another
+  * fiber runs.
+  */
+int eval_compact() {
+  int op, v, *tmp, *lsp, *lbp, lax;
+  char *p, *start;
+
+  p = (char*)pc;
+  lsp = sp;
+  lbp = bp;
+  lax = ax;
+  while (1) {
+    if (++cycle == fiber_deadline) {
+      pc = (int*)p;
+      p = compact_switch(lsp, lbp, lax, &lsp, &lbp, &lax);
+    }
+    start = p;
+    op = *(unsigned char*)p++;
+    if (op & 0xc0 || op <= ADJ) {
+      // decode the operand once for every instruction that has one
+      v = op >> 6;
+      op = op & 0x3f;
+      if (v == Byte1)      {v = *(int8_t*)p; p = p + 1;}
+      else if (v == Byte2) {v = *(int16_t*)p; p = p + 2;}
+      else if (v == Byte4) {v = *(int32_t*)p; p = p + 4;}
+      else                 {v = *(int*)p; p = p + sizeof(int);}
+
+      if (op == IMM)       lax = v;
+      else if (op == LEA)  lax = (int)(lbp + v);
+      else if (op == JZ)   {if (!lax) p = start + v;}
+      else if (op == JNZ)  {if (lax) p = start + v;}
+      else if (op == JMP)  {
+        if (v < 0 && max_cycles && --cycles_left < 0) {
+          return watchdog(compact_text(start));
+        }
+        p = start + v;
+      }
+      else if (op == CALL) {
+        if (max_cycles && --cycles_left < 0) {
+          return watchdog(compact_text(start));
+        }
+        compact_pc = start;
+        *--lsp = (int)p;
+        p = start + v;
+      }
+      else if (op == ENT)  {
+        compact_pc = start;
+        *--lsp = (int)lbp;
+        lbp = lsp;
+        lsp = lsp - v;
+        if (v * sizeof(int) >= guard_size) {
+          stack_probe(lbp, lsp);
+        }
+      }
+      else if (op == ADJ)  lsp = lsp + v;
+      else if (op == ADDI) lax = lax + v;
+      else if (op == NATV) {
+        tmp = lsp + ((int*)v)[Params];
+        lax = ((int (*)())((int*)v)[Value])(tmp[-1], tmp[-2], tmp[-3], tmp[-4], tmp[-5], tmp[-6]);
+      }
+      else if (op == IMMF) lax = (int)(start + v);
+      else {
+        printf("unknown instructions: (%d)\n", op);
+        return -1;
+      }
+    }
+    else if (op == PUSH) *--lsp = lax;
+    else if (op == LI)   lax = *(int*)lax;
+    else if (op == LC)   lax = *(char*)lax;
+    else if (op == SI)   *(int*)*lsp++ = lax;
+    else if (op == SC)   *(char*)*lsp++ = lax;
+    else if (op == LEV)  {lsp = lbp; lbp = (int*)*lsp++; p = compact_pc = (char*)*lsp++;}
+    else if (op == ADD)  lax = *lsp++ + lax;
+    else if (op == SUB)  lax = *lsp++ - lax;
+    else if (op == LT)   lax = *lsp++ < lax;
+    else if (op == EQ)   lax = *lsp++ == lax;
+    else if (op == MUL)  lax = *lsp++ * lax;
+    else if (op == AND)  lax = *lsp++ & lax;
+    else if (op == NE)   lax = *lsp++ != lax;
+    else if (op == GT)   lax = *lsp++ >  lax;
+    else if (op == LE)   lax = *lsp++ <= lax;
+    else if (op == GE)   lax = *lsp++ >= lax;
+    else if (op == OR)   lax = *lsp++ | lax;
+    else if (op == XOR)  lax = *lsp++ ^ lax;
+    else if (op == SHL)  lax = *lsp++ << lax;
+    else if (op == SHR)  lax = *lsp++ >> lax;
+    else if (op == DIV)  lax = *lsp++ / lax;
+    else if (op == MOD)  lax = *lsp++ % lax;
+    else if (op == FADD) lax = double_bits(bits_double(*lsp++) + bits_double(lax));
+    else if (op == FSUB) lax = double_bits(bits_double(*lsp++) - bits_double(lax));
+    else if (op == FMUL) lax = double_bits(bits_double(*lsp++) * bits_double(lax));
+    else if (op == FDIV) lax = double_bits(bits_double(*lsp++) / bits_double(lax));
+    else if (op == FEQ)  lax = bits_double(*lsp++) == bits_double(lax);
+    else if (op == FNE)  lax = bits_double(*lsp++) != bits_double(lax);
+    else if (op == FLT)  lax = bits_double(*lsp++) <  bits_double(lax);
+    else if (op == FGT)  lax = bits_double(*lsp++) >  bits_double(lax);
+    else if (op == FLE)  lax = bits_double(*lsp++) <= bits_double(lax);
+    else if (op == FGE)  lax = bits_double(*lsp++) >= bits_double(lax);
+    else if (op == ITOF) lax = double_bits((double)lax);
+    else if (op == FTOI) lax = (int)bits_double(lax);
+
+    // inner functions, as in eval()
+    else if (op == SNAP) { lax = snapshot();}
+    else if (op == EXIT) { printf("exit(%d)", *lsp); return *lsp;}
+    else if (op == OPEN) { lax = open((char *)lsp[1], lsp[0]); }
+    else if (op == CLOS) { lax = close(*lsp);}
+    else if (op == READ) {
+      if (fiber_live > 1 && !fiber_ready(lsp[2])) {
+        pc = (int*)start;
+        fibers[fiber_current * FiberSize + FiberState] = Blocked;
+        fibers[fiber_current * FiberSize + FiberFd] = lsp[2];
+        p = compact_switch(lsp, lbp, lax, &lsp, &lbp, &lax);
+      } else {
+        lax = read(lsp[2], (char *)lsp[1], *lsp);
+      }
+    }
+    else if (op == PRTF) { tmp = lsp + compact_operand(p); lax = print_format((char *)tmp[-1], tmp - 2); }
+    else if (op == MALC) { lax = (int)malloc(*lsp); malloc_calls++; malloc_bytes = malloc_bytes + *lsp;}
+    else if (op == MSET) { lax = (int)memset((char *)lsp[2], lsp[1], *lsp);}
+    else if (op == MCMP) { lax = memcmp((char *)lsp[2], (char *)lsp[1], *lsp);}
+    else if (op == SPWN) { lax = fiber_spawn((int *)lsp[1], *lsp);}
+    else if (op == YILD) { lax = fiber_live - 1; if (lax > 0) {pc = (int*)p; p = compact_switch(lsp, lbp, lax, &lsp, &lbp, &lax);}}
+    else if (op == ARED) { lax = aio_submit(lsp[2], (char *)lsp[1], *lsp);}
+    else if (op == APOL) { lax = aio_poll(*lsp);}
+    else if (op == AWAT) {
+      if (fiber_live > 1 && !aio_poll(*lsp)) {
+        pc = (int*)start;
+        p = compact_switch(lsp, lbp, lax, &lsp, &lbp, &lax);
+      } else {
+        lax = aio_wait(*lsp);
+      }
+    }
+    else if (op == FEND) {
+      fibers[fiber_current * FiberSize + FiberState] = Finished;
+      fiber_live--;
+      pc = (int*)p;
+      p = compact_switch(lsp, lbp, lax, &lsp, &lbp, &lax);
+    }
+    else {
+      printf("unknown instructions: (%d)\n", op);
+      return -1;
+    }
+  }
+  return 0;
+}
+
 /**
   * the procedure as follows: 1)read a c-code file to main memory
   * 2) token parse for all characters and print it.
   */
 int main(int argc, char **argv) {
+  int64_t start;
   int i, fd;
   int *tmp;
+  pthread_t worker;
+  struct sigaction action;
+  struct itimerval timer;
 
   argc--;
   argv++;
 
   poolsize = 256 * 1024;
   line = 1;
+  fiber_slice = 10000;
+  fiber_stack = 16 * 1024;
+
+  // parse options
+  while (argc > 0 && **argv == '-') {
+    if (!strcmp(*argv, "-inline") && argc > 1) {
+      inline_size = atoi(argv[1]);
+      argc--;
+      argv++;
+    } else if (!strcmp(*argv, "-dce")) {
+      dce = 1;
+    } else if (!strcmp(*argv, "-S")) {
+      dump_text = 1;
+    } else if (!strcmp(*argv, "-tier") && argc > 1) {
+      tier_threshold = atoi(argv[1]);
+      argc--;
+      argv++;
+    } else if (!strcmp(*argv, "-l") && argc > 1) {
+      // functions declared without body and never defined are looked up here
+      if (!dlopen(argv[1], RTLD_NOW | RTLD_GLOBAL)) {
+        printf("could not load (%s): %s\n", argv[1], dlerror());
+        return -1;
+      }
+      argc--;
+      argv++;
+    } else if (!strcmp(*argv, "-serve") && argc > 1) {
+      serve_path = argv[1];
+      argc--;
+      argv++;
+    } else if (!strcmp(*argv, "-batch") && argc > 1) {
+      batch_workers = atoi(argv[1]);
+      argc--;
+      argv++;
+    } else if (!strcmp(*argv, "-max-cycles") && argc > 1) {
+      set_max_cycles(atoi(argv[1]));
+      argc--;
+      argv++;
+    } else if (!strcmp(*argv, "-stats")) {
+      stats = 1;
+      stats_calibrate();
+    } else if (!strcmp(*argv, "-lazy")) {
+      lazy = 1;
+    } else if (!strcmp(*argv, "-verify")) {
+      verify_report = 1;
+    } else if (!strcmp(*argv, "-mem")) {
+      mem_report = 1;
+    } else if (!strcmp(*argv, "-compact")) {
+      compact = 1;
+    } else if (!strcmp(*argv, "-jobs") && argc > 1) {
+      jobs = atoi(argv[1]);
+      argc--;
+      argv++;
+    } else if (!strcmp(*argv, "-lex") && argc > 1) {
+      lex_threads = atoi(argv[1]);
+      argc--;
+      argv++;
+    } else if (!strcmp(*argv, "-sample") && argc > 1) {
+      sample_file = argv[1];
+      argc--;
+      argv++;
+    } else if (!strcmp(*argv, "-slice") && argc > 1) {
+      fiber_slice = atoi(argv[1]);
+      argc--;
+      argv++;
+    } else {
+      printf("unknown option (%s)\n", *argv);
+      return -1;
+    }
+    argc--;
+    argv++;
+  }
+
+  if (jobs && inline_size) {
+    // inlining copies the finished code of the callee
+    printf("-inline is ignored with -jobs\n");
+    inline_size = 0;
+  }
+
+  if (compact && (tier_threshold || sample_file)) {
+    // both map `pc` to the words of `text`
+    printf("-tier and -sample are ignored with -compact\n");
+    tier_threshold = 0;
+    sample_file = 0;
+  }
+
+  if (lazy && (jobs || lex_threads || compact || tier_threshold || dce || dump_text)) {
+    // all of them need the code or the tokens of every function up front
+    printf("-lazy is ignored with -jobs, -lex, -compact, -tier, -dce and -S\n");
+    lazy = 0;
+  }
+
+  if (argc < 1) {
+    printf("usage: framework [-lex threads] [-jobs threads] [-inline size] [-dce] [-tier threshold] [-compact] [-slice cycles] [-sample file] [-l library] [-serve socket] [-batch workers] [-max-cycles n] [-mem] [-lazy] [-verify] [-stats] [-S] file ...\n");
+    return -1;
+  }
   
+  start = stats_clock();
   if ((fd = open(*argv, 0)) < 0) {
     printf("could not open (%s)\n", *argv);
     return -1;
@@ -1351,24 +5395,66 @@ int main(int argc, char **argv) {
 
   src[i] = 0;           // add EOF character
   close(fd);
+  stats_phases[StatRead] = stats_clock() - start;
 
   // allocate memory for virtual machine
   if (!(text = old_text = malloc(poolsize))) {
     printf("could not malloc (%d) for text area\n", poolsize);
     return -1;
   }
-  if (!(data = malloc(poolsize))) {
+  if (!(data = old_data = malloc(poolsize))) {
     printf("could not malloc (%d) for data area\n", poolsize);
     return -1;
   }
-  if (!(stack = malloc(poolsize))) {
-    printf("could not malloc (%d) for stack area\n", poolsize);
+  if (!(stack = new_stack(poolsize))) {
+    printf("could not mmap (%d) for stack area\n", poolsize);
+    return -1;
+  }
+  if (!(symbols = malloc(poolsize))) {
+    printf("could not malloc (%d) for symbol table\n", poolsize);
+    return -1;
+  }
+  // with parallel code generation the trees of all functions are kept
+  i = jobs ? 4 * poolsize : poolsize;
+  if (!(ast = old_ast = malloc(i))) {
+    printf("could not malloc (%d) for syntax tree\n", i);
+    return -1;
+  }
+  ast_end = old_ast + i / sizeof(int);
+  if (jobs && !(gen_jobs = malloc(poolsize / IdSize * GenSize))) {
+    printf("could not malloc (%d) for code generation\n", poolsize / IdSize * GenSize);
+    return -1;
+  }
+  if (lazy && !(lazy_jobs = malloc(poolsize / IdSize * LazySize))) {
+    printf("could not malloc (%d) for lazy compilation\n", poolsize / IdSize * LazySize);
+    return -1;
+  }
+  if (!(lines = malloc(poolsize))) {
+    printf("could not malloc (%d) for line table\n", poolsize);
+    return -1;
+  }
+  if (!(structs = malloc((PTR - STRUCT) * StructSize * sizeof(int))) || !(members = malloc(poolsize))) {
+    printf("could not malloc (%d) for struct table\n", poolsize);
     return -1;
   }
 
   memset(text, 0, poolsize);
   memset(data, 0, poolsize);
-  memset(stack, 0, poolsize);
+  memset(symbols, 0, poolsize);
+  symbol_end = symbols;
+
+  // index of the symbol table, at most half full
+  id_mask = 1;
+  while (id_mask < 2 * poolsize / (IdSize * sizeof(int))) {
+    id_mask = id_mask * 2;
+  }
+  if (!(id_index = malloc(id_mask * sizeof(int)))) {
+    printf("could not malloc (%d) for symbol index\n", id_mask * sizeof(int));
+    return -1;
+  }
+  memset(id_index, 0, id_mask * sizeof(int));
+  id_mask--;
+  memset(lines, 0, poolsize);
 
   bp = sp = (int*)((int)stack + poolsize);
   ax = 0;
@@ -1386,12 +5472,13 @@ int main(int argc, char **argv) {
   pc = text;
 
   // test token parse
-  src = "char else enum if int return sizeof while "
-        "open read close printf malloc memset memcmp exit void main";
+  start = stats_clock();
+  src = "char else enum if int return sizeof while struct double "
+        "open read close printf malloc memset memcmp spawn yield aread apoll await snapshot exit void main";
 
   // add keywords to symbol table
   i = Char;
-  while (i <= While) {
+  while (i <= Double) {
     next();
     current_id[Token] = i++;
   }
@@ -1407,9 +5494,85 @@ int main(int argc, char **argv) {
 
   next(); current_id[Token] = Char;
   next(); idmain = current_id;
+  stats_phases[StatBootstrap] = stats_clock() - start;
+  stats_phases[StatLex] = 0;
+  stats_tokens = stats_lookups = stats_inserts = 0;
 
-
+  src = old_src;
+  start = stats_clock();
   program();
+  stats_phases[StatLex] = stats_phases[StatLex] + (int64_t)lex_time * 1000;
+  stats_phases[StatCodegen] = stats_clock() - start - stats_phases[StatLex];
+
+  if (lex_threads) {
+    printf("lexed %d tokens in %d us on %d threads\n", lex_count, lex_time, lex_threads);
+  }
+
+  if (inline_size) {
+    printf("inlined %d calls\n", inline_count);
+  }
+
+  if (dce) {
+    printf("eliminated %d bytes of unreachable functions\n", eliminate_functions() * sizeof(int));
+  }
+
+  if (dump_text) {
+    disassemble();
+    if (stats) {
+      stats_dump();
+    }
+    return 0;
+  }
+
+  if (!idmain[Value]) {
+    printf("main() not defined\n");
+    return -1;
+  }
+
+  if (verify() < 0) {
+    return -1;
+  }
+  if (verify_report) {
+    verify_dump();
+  }
+
+  if (compact) {
+    code_size = compact_encode();
+    printf("compact code: %d bytes, text %d bytes\n", code_size, (text - old_text) * sizeof(int));
+  }
+  pc = code ? (int*)(code + code_offsets[(int*)idmain[Value] - old_text]) : (int*)idmain[Value];
+
+  if (batch_workers && argc > 1) {
+    // the forked runs go on with argv[1] set to their input
+    if ((i = batch_run(argv + 1, argc - 1)) < 0) {
+      return batch_failed ? 1 : 0;
+    }
+    argv[1] = argv[1 + i];
+    argc = 2;
+  }
+
+  if (tier_threshold) {
+    // optimized code goes after the compiled code
+    if (!(tier_counts = malloc(poolsize)) || !(tier_jobs = malloc(poolsize))) {
+      printf("could not malloc (%d) for tier counters\n", poolsize);
+      return -1;
+    }
+    memset(tier_counts, 0, poolsize);
+    tier_text = text + 1;
+    tier_end = old_text + poolsize / sizeof(int);
+    pthread_mutex_init(&tier_lock, 0);
+    pthread_cond_init(&tier_wake, 0);
+    if (pthread_create(&worker, 0, tier_worker, 0)) {
+      printf("could not start tier worker\n");
+      return -1;
+    }
+  }
+
+  // catch overflow of the stack
+  memset(&action, 0, sizeof(action));
+  action.sa_sigaction = stack_overflow;
+  action.sa_flags = SA_SIGINFO;
+  sigaction(SIGSEGV, &action, 0);
 
   // setup stack
   sp = (int*)((int)stack + poolsize);
@@ -1418,7 +5581,37 @@ int main(int argc, char **argv) {
   tmp = sp;
   *--sp = argc;
   *--sp = (int)argv;
-  *--sp = (int) tmp;
+  *--sp = code ? (int)code : (int)tmp;
 
-  return eval();
+  if (sample_file) {
+    // sample every millisecond of cpu time
+    if (!(samples = sample_top = malloc(16 * poolsize))) {
+      printf("could not malloc (%d) for samples\n", 16 * poolsize);
+      return -1;
+    }
+    sample_end = samples + 16 * poolsize / sizeof(int);
+    signal(SIGPROF, sample);
+    timer.it_interval.tv_sec = timer.it_value.tv_sec = 0;
+    timer.it_interval.tv_usec = timer.it_value.tv_usec = 1000;
+    setitimer(ITIMER_PROF, &timer, 0);
+  }
+
+  start = stats_clock();
+  i = code ? eval_compact() : eval();
+  stats_phases[StatEval] = stats_clock() - start;
+  if (sample_file) {
+    timer.it_interval.tv_usec = timer.it_value.tv_usec = 0;
+    setitimer(ITIMER_PROF, &timer, 0);
+    sample_dump();
+  }
+  if (tier_threshold) {
+    tier_dump();
+  }
+  if (mem_report) {
+    mem_dump();
+  }
+  if (stats) {
+    stats_dump();
+  }
+  return i;
 }